@@ -0,0 +1,258 @@
+/*
+ * batch.c
+ *
+ * batch.c offers coding many files in one run, for "huffenc -a" and
+ * "huffdec -a", so a directory of small files doesn't need a process
+ * for each file.
+ *
+ * Files are taken one by one by threads of the pool, and each file is
+ * coded as a whole in memory by hufflib.c, as the stream of
+ * "huffenc -p". Each thread keeps its huff_struct and buffers for all
+ * files it codes, so nothing is made again for each file. Encoded file
+ * of "name" is "name.huf", and it is decoded back to "name".
+ *
+ * A file which can't be read, written or decoded is reported and
+ * skipped, and the other files are still coded.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "hufflib.h"
+#include "batch.h"
+#include "pool.h"
+
+/*
+ * Files and threads of one run of run_batch().
+ */
+typedef struct batchrun *batchrun_pointer;
+typedef struct batchrun {
+  char **files;  // names of files to code
+  int decode;    // 1 if decoding
+  batch_struct thread[MAX_THREADS];
+} batchrun_struct;
+
+/*
+ * function read_filelist
+ *
+ * Make a list of nnames names and names of files in listname, one on
+ * each line. Empty lines are skipped. listname "-" is standard input,
+ * and NULL adds no name.
+ *
+ * Returns:
+ *      List of names, and its length in nfiles.
+ */
+char **read_filelist(char *listname, char **names, int nnames, int *nfiles)
+{
+  char **files, line[4096];
+  int n, alloc = nnames + 1024;
+  FILE *f = NULL;
+
+  files = malloc(alloc * sizeof(char *));
+  if (files == NULL) {
+    fprintf(stderr, "Out of memory!\n");
+    exit(1);
+  }
+  for (n=0; n<nnames; n++) files[n] = names[n];
+  if (listname != NULL) {
+    f = (strcmp(listname, "-") == 0 ? stdin : fopen(listname, "r"));
+    if (f == NULL) {
+      file_error(listname);
+      exit(1);
+    }
+    while (fgets(line, sizeof(line), f) != NULL) {
+      line[strcspn(line, "\r\n")] = '\0';
+      if (line[0] == '\0') continue;
+      if (n == alloc) {  // grow list
+        alloc *= 2;
+        files = realloc(files, alloc * sizeof(char *));
+      }
+      if (files == NULL || (files[n] = strdup(line)) == NULL) {
+        fprintf(stderr, "Out of memory!\n");
+        exit(1);
+      }
+      n++;
+    }
+    if (f != stdin) fclose(f);
+  }
+  *nfiles = n;
+  return files;
+}
+
+/*
+ * function grow
+ *
+ * Make buf of *alloc bytes at least size bytes.
+ *
+ * Returns:
+ *      0 if grown, -1 if out of memory.
+ */
+static int grow(unsigned char **buf, long long *alloc, long long size)
+{
+  unsigned char *p;
+  if (size <= *alloc) return 0;
+  p = realloc(*buf, size);
+  if (p == NULL) return -1;
+  *buf = p;
+  *alloc = size;
+  return 0;
+}
+
+/*
+ * function load_file
+ *
+ * Read the whole regular file filename to *buf, grown if needed, with
+ * slack 0 bytes after it.
+ *
+ * Returns:
+ *      Size of the file, or -1 if it can't be read.
+ */
+static long long load_file(char *filename, unsigned char **buf, long long *alloc, int slack)
+{
+  struct stat st;
+  long long size;
+  FILE *f = fopen(filename, "rb");
+  if (f == NULL) return -1;
+  if (fstat(fileno(f), &st) != 0 || !S_ISREG(st.st_mode) ||
+      grow(buf, alloc, st.st_size + slack) < 0 ||
+      (size = fread(*buf, 1, st.st_size, f)) != st.st_size) {
+    fclose(f);
+    return -1;
+  }
+  fclose(f);
+  memset(*buf + size, 0, slack);
+  return size;
+}
+
+/*
+ * function save_file
+ *
+ * Write size bytes of buf to filename.
+ *
+ * Returns:
+ *      0 if written, -1 if not.
+ */
+static int save_file(char *filename, unsigned char *buf, long long size)
+{
+  FILE *f = fopen(filename, "wb");
+  int ok;
+  if (f == NULL) return -1;
+  ok = (size == 0 || fwrite(buf, 1, size, f) == size);
+  ok &= (fclose(f) == 0);
+  return (ok ? 0 : -1);
+}
+
+/*
+ * function batch_job
+ *
+ * Encode file i to its name with BATCH_SUFFIX, or decode it to its
+ * name without BATCH_SUFFIX, by the buffers of thread. Run by
+ * run_thread_jobs().
+ */
+static void batch_job(void *arg, int thread, int i)
+{
+  batchrun_pointer run = arg;
+  batch_pointer b = &run->thread[thread];
+  char *name = run->files[i], *outname;
+  int len = strlen(name), suffix = strlen(BATCH_SUFFIX);
+  long long size, n;
+
+  outname = malloc(len + suffix + 1);
+  if (outname == NULL) {
+    fprintf(stderr, "Out of memory!\n");
+    exit(1);
+  }
+  strcpy(outname, name);
+  if (!run->decode)
+    strcat(outname, BATCH_SUFFIX);
+  else if (len > suffix && strcmp(name + len - suffix, BATCH_SUFFIX) == 0)
+    outname[len - suffix] = '\0';
+  else {
+    fprintf(stderr, "Not a %s file: %s\n", BATCH_SUFFIX, name);
+    b->failed++;
+    free(outname);
+    return;
+  }
+
+  size = load_file(name, &b->in, &b->inalloc, (run->decode ? 8 : 0));  // 8 bytes for refill
+  if (size < 0) {
+    file_error(name);
+    b->failed++;
+    free(outname);
+    return;
+  }
+  if (!run->decode) {
+    n = -1;
+    if (grow(&b->out, &b->outalloc, huff_bound(b->hp, size)) == 0)
+      n = huff_encode(b->hp, b->in, size, b->out, b->outalloc);
+  }
+  else {
+    n = huff_decoded_size(b->in, size);
+    if (n >= 0 && grow(&b->out, &b->outalloc, n) == 0)
+      n = (huff_decode(b->hp, b->in, size, b->out, n) == n ? n : -1);
+    else n = -1;
+  }
+  if (n < 0) {
+    fprintf(stderr, (run->decode ? "Broken stream: %s\n" : "Out of memory: %s\n"), name);
+    b->failed++;
+  }
+  else if (save_file(outname, b->out, n) < 0) {
+    file_error(outname);
+    b->failed++;
+  }
+  else {
+    b->files++;
+    b->bytesin += size;
+    b->bytesout += n;
+  }
+  free(outname);
+}
+
+/*
+ * function run_batch
+ *
+ * Encode or decode nfiles files on nthreads threads, and print the
+ * totals of all files when done.
+ *
+ * Arguments:
+ *      char **files, int nfiles - names of files.
+ *      int decode - 1 to decode files named with BATCH_SUFFIX.
+ *      int nthreads - number of threads, 1 to MAX_THREADS.
+ *      int maxbits, int nstreams, int blocksize - options of streams,
+ *          0 for default, as huff_new(). Not used for decoding.
+ *
+ * Returns:
+ *      Number of files that failed.
+ */
+int run_batch(char **files, int nfiles, int decode, int nthreads, int maxbits, int nstreams, int blocksize)
+{
+  static batchrun_struct run;
+  long long bytesin = 0, bytesout = 0;
+  int t, done = 0, failed = 0;
+
+  run.files = files;
+  run.decode = decode;
+  for (t=0; t<nthreads; t++) {
+    memset(&run.thread[t], 0, sizeof(batch_struct));
+    run.thread[t].hp = huff_new(maxbits, nstreams, blocksize);
+    if (run.thread[t].hp == NULL) {
+      fprintf(stderr, "Out of memory!\n");
+      exit(1);
+    }
+  }
+  run_thread_jobs(nthreads, nfiles, batch_job, &run);
+  for (t=0; t<nthreads; t++) {  // totals of threads
+    done += run.thread[t].files;
+    failed += run.thread[t].failed;
+    bytesin += run.thread[t].bytesin;
+    bytesout += run.thread[t].bytesout;
+    huff_free(run.thread[t].hp);
+    free(run.thread[t].in);
+    free(run.thread[t].out);
+  }
+  printf("%d files, %lld bytes -> %lld bytes(%3.1f%%)", done, bytesin, bytesout,
+         (bytesin != 0 ? (double)bytesout/bytesin*100 : 0));
+  if (failed != 0) printf(", %d failed", failed);
+  printf("\n");
+  return failed;
+}
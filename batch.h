@@ -0,0 +1,30 @@
+/*
+ * batch.h
+ *
+ * Header file for batch.c
+ *
+ * batch.c codes many files in one run on a pool of threads, for
+ * "huffenc -a" and "huffdec -a". Include hufflib.h before this file.
+ */
+
+#define BATCH_SUFFIX ".huf"  // Added to names of files encoded in batch mode.
+
+/*
+ * batch_pointer
+ *
+ * State and buffers of one thread of batch mode, kept for all files
+ * the thread codes, so memory is allocated again only for a file
+ * larger than all before, and counters of the files.
+ */
+typedef struct batch *batch_pointer;
+typedef struct batch {
+  huff_pointer hp;         // state of coding, made once
+  unsigned char *in, *out; // whole input and output file
+  long long inalloc, outalloc;  // allocated bytes of in and out
+  int files, failed;       // files coded and files that failed
+  long long bytesin, bytesout;  // bytes read and written
+} batch_struct;
+
+/* Functions batch.c offers */
+extern char **read_filelist(char *listname, char **names, int nnames, int *nfiles);
+extern int run_batch(char **files, int nfiles, int decode, int nthreads, int maxbits, int nstreams, int blocksize);
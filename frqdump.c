@@ -19,6 +19,9 @@
  * Usage:
  *  frqdump [frq_file]
  *
+ * frq_file may be code length file, or container file of "huffenc -k",
+ * whose header has the code lengths.
+ *
  * Default frequency file: "huffman.frq"
  * 
  * You can simply type "frqdump"
@@ -27,32 +30,48 @@
  * Date: 2003/11/22
  */
 #include <stdio.h>
+#include <string.h>
 #include "huff.h"
 
-extern char frqfilename[256];
-extern int frq[256], bitlength[256], huffcode[256], tmplen, tmpcode, originalsize;
+extern char frqfilename[256], binfilename[256];
+extern long long frq[256], originalsize;
+extern int tmplen, tmpcode, maxbits, blocktables, ntables, dictionary;
+extern code_struct filecode;
 extern unsigned char buf[BUFSIZ], wbuf[BUFSIZ];
-extern heap_pointer h;
-extern tnode_pointer root;
+extern int root;
+
+int lenfile=0;  // 1 if frequency file is code length file
 
 /*
  * function dump_frq
  *
  * Type of dump ::
  * Code: 0x41  Char: 'A'  Frqncy: 250 Huffman Code: 1000110
+ *
+ * Code length file has no frequency, so code length is dumped instead.
+ * Code: 0x41  Char: 'A'  Length: 7  Huffman Code: 1000110
  */
 void dump_frq()
 {
+  int *bitlength = filecode.bitlength, *huffcode = filecode.huffcode;
   int i, j;
   char c;
 
-  printf("frequency file dump utility.\nDumping file %s\n\nOriginal Size: %d\n", frqfilename, originalsize);
+  printf("frequency file dump utility.\nDumping file %s\n\nOriginal Size: %lld\n", frqfilename, originalsize);
+  if (lenfile) printf("Canonical Huffman Code\n");
+  if (maxbits != 0) printf("Maximum Code Length: %d\n", maxbits);
+  if (blocktables) printf("Each block has its own code\n");
+  if (dictionary) printf("Dictionary for many inputs\n");
+  if (ntables != 0) printf("Each block has one of %d codes in bin file\n", ntables);
   printf("List of Frequency and Huffman Code. . .\n");
   for (i=0; i<256; i++) {
-    if (frq[i] > 0) {
+    if (bitlength[i] > 0) {
       if (i < 32) c = ' ';
       else c = (char)i;
-      printf("Code: 0x%x\tChar: \'%1c\'\tFrqncy: %d\tHuffman Code: ", i, c, frq[i]);
+      if (lenfile)
+        printf("Code: 0x%x\tChar: \'%1c\'\tLength: %d\tHuffman Code: ", i, c, bitlength[i]);
+      else
+        printf("Code: 0x%x\tChar: \'%1c\'\tFrqncy: %lld\tHuffman Code: ", i, c, frq[i]);
       for (j=bitlength[i]-1; j>=0;j--)
         printf("%d", (huffcode[i] >> j) & 1);
       printf("\n");
@@ -68,14 +87,25 @@ void dump_frq()
  *  2. Make huffman tree.
  *  3. Make huffman code.
  *  4. Dump frequency and huffman code.
+ *
+ * Code length file is read instead, if frq_file is code length file or
+ * container file.
  */
 int main(int argc, char *argv[])
 {
   if (argc < 2)
     strcpy(frqfilename, DEF_FRQFILE);
-  read_frqfile();       // Read frequency file.
-  make_hufftree();      // Make huffman tree.
-  make_huffcode(root);  // Make huffman code.
+  else
+    strcpy(frqfilename, argv[1]);
+  strcpy(binfilename, frqfilename);
+  lenfile = read_container() || read_lenfile();  // Read container or code length file,
+  if (lenfile)
+    make_canonical(&filecode);  // and make canonical code.
+  else {
+    read_frqfile();       // Read frequency file.
+    make_hufftree();      // Make huffman tree.
+    make_huffcode(root);  // Make huffman code.
+  }
   dump_frq();           // Dump frequency and huffman code.
   return 0;
 }
@@ -5,22 +5,58 @@
  *
  * This huffman coding is general purpose.
  *   - Can encode binary files.
- *   - Can encode maximum 2 Giga Bytes file. (int range)
+ *   - Sizes and frequencies are 64 bits, so files over 4 Giga Bytes
+ *     can be encoded.
  *   - Buffered file I/O, so encode/decode faster.
  *
  * Author: Yeom Jaehyun
  * Date 2003/11/22
  */
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "huff.h"
+#include "pool.h"
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define PACK_HAVE_AVX2  // pack_avx2() is built, and used if the CPU has AVX2
+#endif
 
 /* global variables */
 char infilename[256], binfilename[256], frqfilename[256], outfilename[256];
-int frq[256], bitlength[256], huffcode[256], tmplen=0, tmpcode;
+long long frq[256];
+int tmplen=0, tmpcode;
+code_struct filecode;  // huffman code of the whole file
 unsigned char buf[BUFSIZ], wbuf[BUFSIZ];
-int originalsize=0, encodedsize=0;
-heap_pointer h;
-tnode_pointer root;
+long long originalsize=0, encodedsize=0;
+tnode_struct tree[MAX_TREENODES];  // nodes of huffman tree of frq
+int treesize=0;  // nodes used in tree
+int root;        // index of the root node in tree
+dectable_struct dectable;  // decoding table of filecode
+int maxbits=0;  // maximum code length, 0 if not limited
+int nstreams=1;  // number of interleaved streams in bin file
+int blocksize=0;  // characters in one block, 0 if bin file is not blocked
+int nthreads=1;   // number of threads
+int blocktables=0;  // 1 if each block has its own code
+int usemmap=0;    // 1 if files are mapped to memory when they can be
+unsigned char *inmap=NULL;  // input file mapped by map_infile(), or NULL
+long long inmapsize=0;  // size of inmap
+int frqshift=0;   // bits frequencies are scaled down by in frequency file
+long long binoffset=0;  // offset of encoded data in bin file, after container header
+int nbuffers=0;   // buffers of a ring more than threads with -q, 0 if not pipelined
+int iosize=DEF_IOSIZE;  // bytes of a buffer of a ring for bin file not blocked
+int ntables=0;    // number of codes of table set blocks choose from, 0 if none
+code_struct tablecode[MAX_TABLES];  // codes of table set
+unsigned char *blocksel=NULL;  // table of each block, made by make_tableset()
+long long (*blockfrq)[256]=NULL;  // frequency of each block, counted for table set
+int nblockfrq=0;  // number of blocks in blockfrq
+int dictionary=0; // 1 if the code is a dictionary trained for many inputs
+int packpath=PACK_AUTO;  // path of pack_codes(), chosen by pack_path()
 
 /*
  * function file_error
@@ -32,11 +68,565 @@ void file_error(char *filename)
   fprintf(stderr, "Couldn't open the file: %s\n", filename);
 }
 
+/*
+ * function map_infile
+ *
+ * Map the whole file to memory for reading, so it is read without
+ * copying through stdio buffers. Only regular files are mapped, so
+ * pipes and empty files are read by fread as before.
+ *
+ * Returns:
+ *      Mapped file, or NULL if not mapped. File size is set to size.
+ */
+unsigned char *map_infile(char *filename, long long *size)
+{
+  struct stat st;
+  void *p;
+  int fd;
+
+  fd = open(filename, O_RDONLY);
+  if (fd < 0) return NULL;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+    close(fd);
+    return NULL;
+  }
+  p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);  // the mapping stays after close
+  if (p == MAP_FAILED) return NULL;
+  madvise(p, st.st_size, MADV_SEQUENTIAL);
+  *size = st.st_size;
+  return p;
+}
+
+/*
+ * function map_outfile
+ *
+ * Create the file of size bytes and map it to memory for writing, so
+ * decoded characters are written right into the file. Only regular
+ * files are mapped, so pipes and devices are written by fwrite.
+ *
+ * Returns:
+ *      Mapped file, or NULL if not mapped.
+ */
+unsigned char *map_outfile(char *filename, long long size)
+{
+  struct stat st;
+  void *p;
+  int fd;
+
+  if (size == 0 || (stat(filename, &st) == 0 && !S_ISREG(st.st_mode))) return NULL;
+  fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0666);
+  if (fd < 0) return NULL;
+  if (ftruncate(fd, size) != 0) {
+    close(fd);
+    return NULL;
+  }
+  p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) return NULL;
+  return p;
+}
+
+/*
+ * function unmap_file
+ *
+ * Unmap the file which map_infile() or map_outfile() mapped.
+ */
+void unmap_file(unsigned char *p, long long size)
+{
+  munmap(p, size);
+}
+
+/*
+ * function put_options
+ *
+ * Save options o, for frequency file, code length file and stream.
+ * Each option is one tag byte and one value byte. Only options that
+ * are not default are saved.
+ *      'L': maximum code length (maxbits), default 0 (not limited)
+ *      'S': number of interleaved streams (nstreams), default 1
+ *      'B': log2 of characters in one block (blocksize), default not
+ *           blocked
+ *      'T': 1 if each block has its own code (blocktables), default 0
+ *      'G': number of codes of table set (ntables), default 0 (no
+ *           table set)
+ *      'D': 1 if the code is a dictionary (dictionary), default 0
+ *      'N': original size, when the frequencies don't add up to it.
+ *           The value is the number of bytes of the size, and the size
+ *           follows with that many bytes, least significant byte first.
+ *
+ * Returns:
+ *      Number of bytes saved to opt, up to OPTIONS_MAXSIZE.
+ */
+int put_options(options_pointer o, unsigned char *opt)
+{
+  long long size;
+  int n = 0;
+  if (o->maxbits != 0) {
+    opt[n++] = 'L';
+    opt[n++] = o->maxbits;
+  }
+  if (o->nstreams != 1) {
+    opt[n++] = 'S';
+    opt[n++] = o->nstreams;
+  }
+  if (o->blocksize != 0) {
+    opt[n++] = 'B';
+    for (opt[n] = 0; (1 << opt[n]) < o->blocksize; opt[n]++) ;
+    n++;
+  }
+  if (o->blocktables != 0) {
+    opt[n++] = 'T';
+    opt[n++] = o->blocktables;
+  }
+  if (o->ntables != 0) {
+    opt[n++] = 'G';
+    opt[n++] = o->ntables;
+  }
+  if (o->dictionary != 0) {
+    opt[n++] = 'D';
+    opt[n++] = o->dictionary;
+  }
+  if (o->size != 0) {
+    opt[n++] = 'N';
+    opt[n] = 0;
+    for (size=o->size; size != 0; size >>= 8) opt[n + ++opt[n]] = size & 0xff;
+    n += 1 + opt[n];
+  }
+  return n;
+}
+
+/*
+ * function get_options
+ *
+ * Read options which put_options() saved to o. Options not saved are
+ * default.
+ *
+ * Returns:
+ *      -1 if read, or offset of the wrong option in opt.
+ */
+int get_options(unsigned char *opt, int size, options_pointer o)
+{
+  int i, k;
+  o->maxbits = 0;
+  o->nstreams = 1;
+  o->blocksize = 0;
+  o->blocktables = 0;
+  o->ntables = 0;
+  o->dictionary = 0;
+  o->size = 0;
+  for (i=0; i+1 < size; i+=2) {
+    switch (opt[i]) {
+    case 'L':
+      if (opt[i+1] != 0 && (opt[i+1] < MIN_MAXBITS || opt[i+1] > MAX_CODELEN)) return i;
+      o->maxbits = opt[i+1];
+      break;
+    case 'S':
+      if (opt[i+1] != 1 && opt[i+1] != 2 && opt[i+1] != 4 && opt[i+1] != 8) return i;
+      o->nstreams = opt[i+1];
+      break;
+    case 'B':
+      if (opt[i+1] > 30 || (1 << opt[i+1]) < MIN_BLOCKSIZE || (1 << opt[i+1]) > MAX_BLOCKSIZE) return i;
+      o->blocksize = 1 << opt[i+1];
+      break;
+    case 'T':
+      if (opt[i+1] > 1) return i;
+      o->blocktables = opt[i+1];
+      break;
+    case 'G':
+      if (opt[i+1] == 0 || opt[i+1] > MAX_TABLES) return i;
+      o->ntables = opt[i+1];
+      break;
+    case 'D':
+      if (opt[i+1] > 1) return i;
+      o->dictionary = opt[i+1];
+      break;
+    case 'N':
+      if (opt[i+1] == 0 || opt[i+1] > 8 || i + 2 + opt[i+1] > size) return i;
+      for (k=opt[i+1]-1; k>=0; k--) o->size = (o->size << 8) | opt[i+2+k];
+      if (o->size < 0) return i;
+      i += opt[i+1];
+      break;
+    default:
+      return i;
+    }
+  }
+  return -1;
+}
+
+/*
+ * function make_options
+ *
+ * Make options of the global variables by put_options(). Original size
+ * is saved only if make_frqfile() scaled frequencies down.
+ *
+ * Returns:
+ *      Number of bytes made to opt.
+ */
+int make_options(unsigned char *opt)
+{
+  options_struct o;
+  o.maxbits = maxbits;
+  o.nstreams = nstreams;
+  o.blocksize = blocksize;
+  o.blocktables = blocktables;
+  o.ntables = ntables;
+  o.dictionary = dictionary;
+  o.size = (frqshift != 0 ? originalsize : 0);
+  return put_options(&o, opt);
+}
+
+/*
+ * function read_options
+ *
+ * Read options which make_options() made by get_options(), and set
+ * the global variables.
+ */
+void read_options(unsigned char *opt, int size)
+{
+  options_struct o;
+  int i = get_options(opt, size, &o);
+  if (i >= 0) {
+    fprintf(stderr, "Wrong option: '%c' %d\n", opt[i], opt[i+1]);
+    exit(1);
+  }
+  maxbits = o.maxbits;
+  nstreams = o.nstreams;
+  blocksize = o.blocksize;
+  blocktables = o.blocktables;
+  ntables = o.ntables;
+  dictionary = o.dictionary;
+  if (o.size != 0) originalsize = o.size;
+}
+
+/*
+ * function count_bytes
+ *
+ * Add frequency of each byte of in to counts.
+ *
+ * Counting to one table, the same counter is increased again and again
+ * on text or one repeated byte, and each increase waits for the one
+ * before it. So bytes are counted to COUNT_TABLES tables in turn and
+ * the tables are summed at the end. Bytes are loaded 8 at a time and
+ * taken out by shifts, instead of one load for each byte.
+ */
+void count_bytes(unsigned char *in, int size, long long *counts)
+{
+  unsigned int c[COUNT_TABLES][256];
+  unsigned long long w;
+  int i, k;
+
+  memset(c, 0, sizeof(c));
+  for (i=0; i+8 <= size; i+=8) {
+    memcpy(&w, in+i, 8);  // load 8 bytes at once
+    c[0][w & 0xff]++;
+    c[1][(w >> 8) & 0xff]++;
+    c[2][(w >> 16) & 0xff]++;
+    c[3][(w >> 24) & 0xff]++;
+    c[4][(w >> 32) & 0xff]++;
+    c[5][(w >> 40) & 0xff]++;
+    c[6][(w >> 48) & 0xff]++;
+    c[7][w >> 56]++;
+  }
+  for (; i<size; i++) c[0][in[i]]++;  // remained bytes
+  for (k=0; k<COUNT_TABLES; k++)
+    for (i=0; i<256; i++) counts[i] += c[k][i];
+}
+
+/*
+ * Chunks counted at once by count_frq(), one for each thread. Chunks
+ * point into countbuf, or into inmap if input file is mapped.
+ */
+static unsigned char *countchunk[MAX_THREADS], *countbuf[MAX_THREADS];
+static int countsize[MAX_THREADS];
+static long long countfrq[MAX_THREADS][256];
+
+/*
+ * function count_job
+ *
+ * Count frequency of chunk i to its own table. Run by run_jobs().
+ */
+static void count_job(void *arg, int i)
+{
+  memset(countfrq[i], 0, sizeof(countfrq[i]));
+  count_bytes(countchunk[i], countsize[i], countfrq[i]);
+}
+
+/*
+ * function count_frq
+ *
+ * Read input file, count frequency of input file and original size.
+ * Input is read by COUNT_CHUNK bytes, and counted by count_bytes().
+ * With nthreads threads, nthreads chunks are read at once and counted
+ * at the same time, each to its own table, then the tables are summed.
+ *
+ * If input file is mapped to inmap, chunks are counted in place and
+ * the file is not read by fread.
+ *
+ * Files smaller than MIN_STREAMS_SIZE are encoded as one stream and
+ * not blocked, as stream sizes would take more than they save.
+ *
+ * Frequency of each block is counted too, to blockfrq, for table set
+ * and for block_kind(). Chunks are cut at the blocks, by blocksize if
+ * it is smaller than COUNT_CHUNK, so each chunk is in one block. If
+ * not blocked, blocks are of DEF_BLOCKSIZE. Inputs of a dictionary are
+ * counted one after another, so blocks are not counted for them.
+ *
+ * A file not blocked is blocked by DEF_BLOCKSIZE if its code can't make
+ * it smaller, or it has only one character, so its blocks are stored or
+ * filled by block_kind() instead of coded.
+ */
+void count_frq()
+{
+  FILE *inf = NULL;  // input file
+  long long pos[MAX_THREADS];  // offset of each chunk
+  code_struct c;
+  int i, j, n, block, chunk = COUNT_CHUNK;
+  int size = (blocksize != 0 ? blocksize : DEF_BLOCKSIZE);  // characters in one block counted
+
+  if (size < chunk) chunk = size;
+  if (inmap == NULL) {
+    inf = fopen(infilename, "rb");  // open input file.
+    if (inf == NULL) {
+      file_error(infilename);  // file not found error
+      exit(1);
+    }
+    for (i=0; i<nthreads; i++) {
+      countchunk[i] = countbuf[i] = malloc(chunk);
+      if (countbuf[i] == NULL) {
+        fprintf(stderr, "Out of memory!\n");
+        exit(1);
+      }
+    }
+  }
+  do {
+    for (n=0; n<nthreads; n++) {  // read chunks
+      if (inmap != NULL) {  // point into the mapped file
+        countchunk[n] = inmap + originalsize;
+        countsize[n] = (inmapsize - originalsize < chunk ? inmapsize - originalsize : chunk);
+      }
+      else
+        countsize[n] = fread(countchunk[n], 1, chunk, inf);
+      if (countsize[n] == 0) break;
+      pos[n] = originalsize;
+      originalsize += countsize[n];  // count original size
+    }
+    if (n == 1 && dictionary) count_bytes(countchunk[0], countsize[0], frq);  // count frequency
+    else if (n > 0) {
+      run_jobs(nthreads, n, count_job, NULL);
+      for (i=0; i<n; i++)
+        for (j=0; j<256; j++) frq[j] += countfrq[i][j];
+    }
+    for (i=0; i<n && !dictionary; i++) {  // add to frequency of blocks
+      block = pos[i] / size;
+      if (block == nblockfrq) {
+        blockfrq = realloc(blockfrq, (nblockfrq + 1) * sizeof(blockfrq[0]));
+        if (blockfrq == NULL) {
+          fprintf(stderr, "Out of memory!\n");
+          exit(1);
+        }
+        memset(blockfrq[nblockfrq++], 0, sizeof(blockfrq[0]));
+      }
+      for (j=0; j<256; j++) blockfrq[block][j] += countfrq[i][j];
+    }
+  } while (n == nthreads && countsize[n-1] == chunk);
+  if (inf != NULL) {
+    for (i=0; i<nthreads; i++) free(countbuf[i]);
+    fclose(inf);/* close input file. */
+  }
+  printf("%lld bytes\n",originalsize);  // write out original size
+  if (originalsize < MIN_STREAMS_SIZE) {  // too small to split
+    nstreams = 1;
+    blocksize = 0;
+  }
+  else if (blocksize == 0 && !dictionary) {  // block if blocks are stored or filled
+    make_blockcode(frq, &c, (maxbits != 0 ? maxbits : MAX_CODELEN));
+    if (block_kind(frq, originalsize, code_bits(frq, &c)) != BLOCK_CODED) blocksize = DEF_BLOCKSIZE;
+  }
+}
+
+/*
+ * function block_kind
+ *
+ * Choose how a block of size characters of frequencies counts is saved,
+ * when it takes bits bits coded, with code lengths and stream sizes.
+ *
+ * Returns:
+ *      BLOCK_RUN if it has only one character, so it is saved as the
+ *      character, BLOCK_STORED if coding doesn't make it smaller, so it
+ *      is saved as it is, or BLOCK_CODED.
+ */
+int block_kind(long long *counts, long long size, long long bits)
+{
+  int i, n = 0;
+  for (i=0; i<256; i++)
+    if (counts[i] != 0) n++;
+  if (n == 1) return BLOCK_RUN;
+  if (bits < 0 || (bits + 7) / 8 >= size) return BLOCK_STORED;
+  return BLOCK_CODED;
+}
+
+/*
+ * function make_table
+ *
+ * Make code c of table set from frequencies counts. Characters of the
+ * file which are not in counts are counted once, so every block can
+ * be coded by every table of the set.
+ */
+static void make_table(long long *counts, code_pointer c)
+{
+  long long smooth[256];
+  int i;
+  for (i=0; i<256; i++) smooth[i] = (counts[i] == 0 && frq[i] != 0 ? 1 : counts[i]);
+  make_blockcode(smooth, c, maxbits);
+}
+
+/*
+ * function choose_tables
+ *
+ * Choose the table of each block, the one that codes the block in the
+ * least bits, and add frequencies of blocks to sum of their tables.
+ *
+ * Returns:
+ *      Bits of all blocks coded by their tables.
+ */
+static long long choose_tables(long long (*sum)[256])
+{
+  long long bits, best, total = 0;
+  int b, t, i;
+
+  memset(sum, 0, ntables * sizeof(sum[0]));
+  for (b=0; b<nblockfrq; b++) {
+    best = -1;
+    for (t=0; t<ntables; t++) {
+      bits = code_bits(blockfrq[b], &tablecode[t]);
+      if (best < 0 || bits < best) {
+        best = bits;
+        blocksel[b] = t;
+      }
+    }
+    for (i=0; i<256; i++) sum[blocksel[b]][i] += blockfrq[b][i];
+    total += best;
+  }
+  return total;
+}
+
+/*
+ * function make_tableset
+ *
+ * Make table set of up to ntables codes from frequencies of blocks,
+ * which count_frq() counted, and choose the table of each block, for
+ * files whose parts have different frequencies. Each block is coded
+ * by its table, and tables are saved once, so a block costs only one
+ * byte for the index of its table.
+ *
+ * The first table is the code of the whole file. Then the block which
+ * the tables code worst, compared to its own code, is added as a new
+ * table, until ntables or no block gains. Then tables are refined for
+ * TABLE_ROUNDS rounds, like k-means: each block chooses its best table,
+ * and each table is made again from the blocks which chose it. Tables
+ * no block chooses are dropped, so ntables may become smaller.
+ *
+ * Files of one block have no table set, ntables is 0 then.
+ */
+void make_tableset()
+{
+  long long sum[MAX_TABLES][256], *cost, *owncost, gain, bits, lastbits = -1;
+  code_struct own;
+  int b, t, i, k, round, best;
+
+  if (blocksize == 0 || nblockfrq < 2) {
+    ntables = 0;
+    return;
+  }
+  blocksel = malloc(nblockfrq);
+  cost = malloc(nblockfrq * sizeof(long long));
+  owncost = malloc(nblockfrq * sizeof(long long));
+  if (blocksel == NULL || cost == NULL || owncost == NULL) {
+    fprintf(stderr, "Out of memory!\n");
+    exit(1);
+  }
+  make_table(frq, &tablecode[0]);  // code of the whole file
+  for (b=0; b<nblockfrq; b++) {
+    cost[b] = code_bits(blockfrq[b], &tablecode[0]);
+    make_table(blockfrq[b], &own);
+    owncost[b] = code_bits(blockfrq[b], &own);
+  }
+  for (k=1; k<ntables; k++) {  // add the block that gains most
+    best = -1;
+    for (b=0, gain=0; b<nblockfrq; b++) {
+      if (cost[b] - owncost[b] > gain) {
+        gain = cost[b] - owncost[b];
+        best = b;
+      }
+    }
+    if (best < 0) break;  // no block gains
+    make_table(blockfrq[best], &tablecode[k]);
+    for (b=0; b<nblockfrq; b++) {
+      bits = code_bits(blockfrq[b], &tablecode[k]);
+      if (bits < cost[b]) cost[b] = bits;
+    }
+  }
+  ntables = k;
+  for (round=0; round<TABLE_ROUNDS; round++) {  // refine tables
+    bits = choose_tables(sum);
+    if (lastbits >= 0 && bits >= lastbits) break;
+    lastbits = bits;
+    for (t=0, k=0; t<ntables; t++) {  // make tables again, drop unused ones
+      for (i=0; i<256 && sum[t][i] == 0; i++) ;
+      if (i == 256) continue;
+      make_table(sum[t], &tablecode[k++]);
+    }
+    ntables = k;
+  }
+  choose_tables(sum);
+  free(cost);
+  free(owncost);
+}
+
+/*
+ * function put_tableset
+ *
+ * Save codes of table set by put_lengths(), one after another. Saved
+ * at the start of encoded data of bin file.
+ *
+ * Returns:
+ *      Number of bytes saved to out, up to MAX_TABLES*LENGTHS_MAXSIZE.
+ */
+int put_tableset(unsigned char *out)
+{
+  int t, n = 0;
+  for (t=0; t<ntables; t++) n += put_lengths(&tablecode[t], out+n);
+  return n;
+}
+
+/*
+ * function get_tableset
+ *
+ * Read codes of table set which put_tableset() saved, and make their
+ * canonical codes.
+ *
+ * Returns:
+ *      Number of bytes read, or -1 if broken.
+ */
+int get_tableset(unsigned char *in, int size)
+{
+  int t, i, n = 0;
+  for (t=0; t<ntables; t++) {
+    i = get_lengths(in+n, size-n, &tablecode[t]);
+    if (i < 0) return -1;
+    make_canonical(&tablecode[t]);
+    n += i;
+  }
+  return n;
+}
+
 /*
  * function make_frqfile
  * 
- * Read input file, count frequency of input file. Frequency file
- * DOES NOT saves huffman tree or huffman code.
+ * Read input file, count frequency of input file by count_frq(), and
+ * write frequency file. Frequency file DOES NOT saves huffman tree or
+ * huffman code.
  *
  * Frequency File Structure :::
  *  To reduce size of frequency file, (as size is very important)
@@ -55,29 +645,32 @@ void file_error(char *filename)
  *  Afrer all headers for 0~255 was written, saves frequency for
  *  frequency is greater than 0, with minimal bytes.
  *
+ *  If a frequency doesn't fit in 4 bytes (files over 4 Giga Bytes),
+ *  all frequencies are scaled down by frqshift bits, rounded up so
+ *  none becomes 0, and the tree is made from the scaled ones. Then the
+ *  frequencies don't add up to original size, so it is saved as
+ *  option 'N'.
+ *
+ *  Options made by make_options() follow the frequencies. Options are
+ *  written only when needed, so a frequency file without options is
+ *  the same as before.
+ *
  * Frequency file does not use block writing, different from bin file.
  * So reading and writing frequency file is slow.
  */
 void make_frqfile()
 {
-  FILE *inf, *frqf;  // input file, frequency file
-  int readsize, i, bitnum=0, bytenum, tmp=0, tmp2;
+  FILE *frqf;  // frequency file
+  unsigned char tmpopt[OPTIONS_MAXSIZE];
+  long long max=0;
+  int i, bitnum=0, bytenum, tmp=0, tmp2;
 
-  inf = fopen(infilename, "rb");  // open input file.
-  if (inf == NULL) {
-    file_error(infilename);  // file not found error
-    exit(1);
-  }
-  while ( (readsize = fread(buf, 1, BUFSIZ, inf)) != 0 ) {
-    /* read one block to buf */
-    putchar('.');  // put one dot for each block
-    fflush(stdout);  // flush dot output
-    originalsize += readsize;  // count original size
-    /* count frequency */
-    for (i=0; i<readsize; i++) frq[(int)buf[i]]++;
-  }
-  fclose(inf);/* close input file. */
-  printf(" %d bytes\n",originalsize);  // write out original size
+  count_frq();
+  for (i=0; i<256; i++)
+    if (frq[i] > max) max = frq[i];
+  for (frqshift=0; ((max + (1LL << frqshift) - 1) >> frqshift) >> 32 != 0; frqshift++) ;
+  if (frqshift != 0)  // scale down to 4 bytes
+    for (i=0; i<256; i++) frq[i] = (frq[i] + (1LL << frqshift) - 1) >> frqshift;
   frqf = fopen(frqfilename, "wb");  // open frequency file
   for (i=0; i<256; i++) {  // for 0 ~ 255
     if (frq[i] == 0) {  // if frequency is 0
@@ -113,6 +706,7 @@ void make_frqfile()
       fwrite(&frq[i], 1, bytenum, frqf);
     }
   }
+  fwrite(tmpopt, 1, make_options(tmpopt), frqf);  // write options
   fclose(frqf);
   
 }
@@ -141,7 +735,8 @@ void make_frqfile()
  *          If "11" frequency is saved by 4 byte.
  * 
  * After reading all 0~255 characters, read each byte of
- * each characters.
+ * each characters. Then read options until end of file. If
+ * frequencies were scaled down, option 'N' sets original size.
  *
  * Frequency file does not use block writing, different from bin file.
  * So reading and writing frequency file is slow.
@@ -188,106 +783,1659 @@ void read_frqfile()
     fread(&frq[i], 1, frq[i], frqf);// read n byte 
     originalsize += frq[i];// add original size by frq[i]
   }
+  read_options(buf, fread(buf, 1, BUFSIZ, frqf));// read options
   fclose(frqf);
 }
 
 /*
- * function make_huffcode
- * 
- * Makes huffman code from huffman tree recursively.
- * Encoding binary files has some difficulties.
+ * function make_lenfile
  *
- * Input: Huffman tree root node
- * 
- * Really Really Worst case :::::::
+ * Write code length file, for canonical huffman code. Code length
+ * file saves only code lengths, instead of frequencies. The decoder
+ * makes canonical codes by make_canonical() from the lengths, so it
+ * doesn't need to make huffman tree. Lengths must not be longer than
+ * 15 bits (LENFILE_MAXBITS), as each takes 4 bits.
  *
- *     one '\0', two '\1's, four '\2's, eight '\3's ...
- *     2^i for '\i' for all character set.
- *     
- *     one + two < four, one + two + four < eight . . .
- *     
- *     Huffman code for '\0' is "0000000 ... 0000000", that's 255 zeros.
- *     Huffman code for '\1' is "0000000 ... 0000001", that's 254 zeros and 1 one.
- *     Huffman code for '\2' is "0000000 ... 000001" , that's 253 zeros and 1 one.
- *     
- *     So maximum size of huffman code is 255.
+ * Code Length File Structure :::
+ *  LENFILE_MAGIC "HUFL", 4 bytes.
+ *  Number of bytes of original size, 1 byte, and original size with
+ *  that many bytes, least significant byte first.
+ *  32 bytes bitmap for 0~255, bit '1' if the character appears,
+ *  the most significant bit of the first byte for 0.
+ *  Code lengths of appeared characters, 4 bits each, the first one at
+ *  the upper 4 bits. If the number of appeared characters is odd, the
+ *  last lower 4 bits are 0.
+ *  Options made by make_options(), until the end of file.
  *
- * So we must use array of int for huffman code.
- * (Actually I made it.....)
- * BUT..... I realized that it exceed 2 Giga byte, if huffman code is longer than 32 bits.
- * So huffcode for one character is just one integer. (T.T) I deleted all code for multi-
- * integer sized huffman code.
+ * The bitmap and the lengths are made by put_lengths(). If each block
+ * has its own code, filecode is empty and no character appears. With
+ * table set, filecode is empty too, and the codes of the set are saved
+ * in bin file by put_tableset().
  *
+ * A dictionary, trained by "huffenc -w" from many inputs, is a code
+ * length file with option 'D'. Every character has a code in it, and
+ * original size is the size of the inputs it was trained from. Bin
+ * files encoded by it start with their own size by put_varsize().
  */
-void make_huffcode(tnode_pointer tn)
+void make_lenfile()
 {
-  if (tn->left == NULL) {  // if leaf node
-    bitlength[(int)tn->c] = tmplen;  // save bit length and
-    huffcode[(int)tn->c] = tmpcode;  // huffman code
-    return;
+  FILE *lenf;
+  unsigned char header[LENFILE_MAXSIZE+OPTIONS_MAXSIZE];
+  int n;
+
+  n = put_lenfile(&filecode, originalsize, header);
+  n += make_options(header+n);
+
+  lenf = fopen(frqfilename, "wb");
+  if (lenf == NULL) {
+    file_error(frqfilename);
+    exit(1);
   }
+  fwrite(header, 1, n, lenf);  // write all at once
+  fclose(lenf);
+}
 
-  /* before recursion to the left */
-  tmpcode = tmpcode << 1;  // add bit 0
-  tmplen++;
+/*
+ * function get_size
+ *
+ * Read size of n bytes, least significant byte first, as code length
+ * file and container file save original size. Built unsigned, so a
+ * broken size can't overflow.
+ *
+ * Returns:
+ *      0 if read, -1 if size is larger than LLONG_MAX.
+ */
+static int get_size(unsigned char *in, int n, long long *size)
+{
+  unsigned long long u = 0;
+  int i;
+  for (i=n-1; i>=0; i--) u = (u << 8) | in[i];
+  if (u > LLONG_MAX) return -1;
+  *size = u;
+  return 0;
+}
 
-  /* recursion to the left */
-  make_huffcode(tn->left);
+/*
+ * function put_lenfile
+ *
+ * Make magic, original size and code lengths of code length file for
+ * code c and original size, as make_lenfile() writes them. Options are
+ * added after them by the caller.
+ *
+ * Returns:
+ *      Number of bytes made to out, up to LENFILE_MAXSIZE.
+ */
+int put_lenfile(code_pointer c, long long size, unsigned char *out)
+{
+  int n;
+  memcpy(out, LENFILE_MAGIC, 4);
+  n = 4;
+  out[n++] = 0;  // number of bytes of original size
+  for (; size != 0; size >>= 8) {
+    out[n++] = size & 0xff;
+    out[4]++;
+  }
+  return n + put_lengths(c, out+n);
+}
 
-  /* before recursion to the right */
-  tmpcode = tmpcode | 1;  // add bit 1
+/*
+ * function get_lenfile
+ *
+ * Read magic, original size and code lengths of code length file
+ * which put_lenfile() made to c and size. Options follow them until
+ * the end.
+ *
+ * Returns:
+ *      Number of bytes read, where options start, 0 if in is not code
+ *      length file, or -1 if it is broken.
+ */
+int get_lenfile(unsigned char *in, int len, code_pointer c, long long *size)
+{
+  int i, n;
+  if (len < 5 || memcmp(in, LENFILE_MAGIC, 4) != 0) return 0;
+  if (in[4] > sizeof(*size) || 5 + in[4] + 32 > len) return -1;
+  if (get_size(in+5, in[4], size) < 0) return -1;  // original size
+  n = 5 + in[4];
+  i = get_lengths(in+n, len-n, c);  // bitmap and code lengths
+  if (i < 0) return -1;
+  return n + i;
+}
 
-  /* recursion to the right */
-  if (tn->right != NULL) make_huffcode(tn->right);
+/*
+ * function read_lenfile
+ *
+ * Read code length file, which make_lenfile wrote, and set lengths of
+ * filecode and originalsize. The whole file is read by one fread.
+ *
+ * Returns:
+ *      1 if read, 0 if the file is not code length file (frequency
+ *      file is read by read_frqfile() then).
+ */
+int read_lenfile()
+{
+  FILE *lenf;
+  unsigned char header[LENFILE_MAXSIZE+OPTIONS_MAXSIZE];
+  int n, size;
 
-  /* recover values after recursions */
-  tmplen--;
-  tmpcode = tmpcode >> 1;
+  lenf = fopen(frqfilename, "rb");
+  if (lenf == NULL) {
+    file_error(frqfilename);
+    exit(1);
+  }
+  size = fread(header, 1, sizeof(header), lenf);
+  fclose(lenf);
+  n = get_lenfile(header, size, &filecode, &originalsize);
+  if (n == 0) return 0;
+  if (n < 0) {
+    fprintf(stderr, "Broken code length file: %s\n", frqfilename);
+    exit(1);
+  }
+  read_options(header+n, size-n);
+  return 1;
 }
 
 /*
- * function make_hufftree
+ * function put_container
  *
- * Make hufftree using heap.
+ * Make the header of container file, which has everything of code
+ * length file and bin file in one file, with "huffenc -k". The code is
+ * canonical huffman code, so only code lengths are saved.
  *
- * 1. For all character set, if frequency is over 0, make new tree node
- *    and put it in min heap.
- * 2. Make new tree node and get 2 items from min heap.
- * 3. Set 2 items as left and right node of the new tree node.
- * 4. Repeat number 2 and number 3 until heap contains only one item.
- * 5. Then the remained tree node is the root node of whole huffman tree.
+ * Container File Structure :::
+ *  CONTAINER_MAGIC "HUFC", 4 bytes.
+ *  CONTAINER_VERSION, 1 byte.
+ *  Original size, 8 bytes, least significant byte first. Always 8
+ *  bytes, so it can be saved again when it is known at the end.
+ *  Bitmap and code lengths of filecode by put_lengths(), as in code
+ *  length file. No character appears if each block has its own code.
+ *  Size of options, 1 byte, and options made by make_options().
+ *  Encoded data, the same as bin file. If blocked, the block index is
+ *  at the end of file.
  *
- * If only 1 character set exists set it as huffcode 0.
- * root -> left = (the only tnode), root->right = NULL.
- * ** Takes left node we can check leaf node if left node is NULL.
+ * Returns:
+ *      Number of bytes made to header, up to CONTAINER_MAXSIZE.
+ */
+int put_container(unsigned char *header)
+{
+  int i, n;
+
+  memcpy(header, CONTAINER_MAGIC, 4);
+  header[4] = CONTAINER_VERSION;
+  for (i=0; i<8; i++) header[5+i] = (originalsize >> (8*i)) & 0xff;
+  n = 13 + put_lengths(&filecode, header+13);
+  header[n] = make_options(header+n+1);
+  return n + 1 + header[n];
+}
+
+/*
+ * function read_container
  *
- * If no character set exists (empty file)
- * root -> left = NULL, root -> right = NULL.
+ * Read the header of container file binfilename, which put_container()
+ * made, and set lengths of filecode, originalsize and options like
+ * read_lenfile(). binoffset is set to the start of encoded data, so
+ * bin file is decoded from there.
+ *
+ * Returns:
+ *      1 if read, 0 if the file is not container file (frq_file is
+ *      read then).
  */
-void make_hufftree()
+int read_container()
 {
-  int i;
-  tnode_pointer tn1, tn2;
-  h = new_heap();  // create new heap.
-  for (i=0; i<256; i++)  // for each character set
-    if (frq[i] > 0)   // if frequency is over 0, add new tnode to heap
-      heap_add(h, new_tnode(frq[i], (unsigned char)i, NULL, NULL));
-  
-  if (h->size <= 1) {  // if heap size is not greater than 1
-    root = new_tnode(0,'\0',heap_remove(h),NULL);
-    /* root->left=(the only tnode), root->right=NULL
-     * If no items are in heap, heap_remove(h) returns NULL
-     * So both case OK.
-     */
-    free_heap(h);  // destroy heap and return
+  FILE *binf;
+  unsigned char header[CONTAINER_MAXSIZE];
+  int i, n, size;
+
+  binf = fopen(binfilename, "rb");
+  if (binf == NULL) {
+    file_error(binfilename);
+    exit(1);
+  }
+  size = fread(header, 1, sizeof(header), binf);
+  fclose(binf);
+  if (size < 5 || memcmp(header, CONTAINER_MAGIC, 4) != 0) return 0;
+  if (header[4] != CONTAINER_VERSION) {
+    fprintf(stderr, "Unknown container version %d: %s\n", header[4], binfilename);
+    exit(1);
+  }
+  if (size < 13 + 32) {
+    fprintf(stderr, "Broken container file: %s\n", binfilename);
+    exit(1);
+  }
+  if (get_size(header+5, 8, &originalsize) < 0) {  // original size
+    fprintf(stderr, "Broken container file: %s\n", binfilename);
+    exit(1);
+  }
+  n = 13;
+  i = get_lengths(header+n, size-n, &filecode);  // bitmap and code lengths
+  if (i < 0 || n + i >= size || n + i + 1 + header[n+i] > size) {
+    fprintf(stderr, "Broken container file: %s\n", binfilename);
+    exit(1);
+  }
+  n += i;
+  read_options(header+n+1, header[n]);
+  if ((blocktables || ntables != 0) && blocksize == 0) {
+    fprintf(stderr, "Broken container file: %s\n", binfilename);
+    exit(1);
+  }
+  binoffset = n + 1 + header[n];
+  return 1;
+}
+
+/*
+ * function put_lengths
+ *
+ * Save code lengths of c, for code length file and for blocks which
+ * have their own code. 32 bytes bitmap for 0~255, bit '1' if the
+ * character appears, the most significant bit of the first byte for 0.
+ * Then code lengths of appeared characters, 4 bits each, the first one
+ * at the upper 4 bits. If the number of appeared characters is odd,
+ * the last lower 4 bits are 0. Lengths must be up to LENFILE_MAXBITS.
+ *
+ * Returns:
+ *      Number of bytes saved to out, up to LENGTHS_MAXSIZE.
+ */
+int put_lengths(code_pointer c, unsigned char *out)
+{
+  int i, n = 32, nibble = 0;
+
+  memset(out, 0, 32);
+  for (i=0; i<256; i++) {
+    if (c->bitlength[i] == 0) continue;
+    out[i/8] |= 0x80 >> (i%8);  // bitmap of appeared characters
+    if (nibble == 0) out[n] = c->bitlength[i] << 4;  // code lengths
+    else out[n++] |= c->bitlength[i];
+    nibble ^= 1;
+  }
+  return n + nibble;
+}
+
+/*
+ * function put_varsize
+ *
+ * Save size with 7 bits in each byte, the lowest 7 bits first, and bit
+ * 0x80 set if more bytes follow, so small sizes take 1 or 2 bytes.
+ *
+ * Returns:
+ *      Number of bytes saved to out, up to VARSIZE_MAXSIZE.
+ */
+int put_varsize(long long size, unsigned char *out)
+{
+  int n = 0;
+  while (size >= 0x80) {
+    out[n++] = (size & 0x7f) | 0x80;
+    size >>= 7;
+  }
+  out[n++] = size;
+  return n;
+}
+
+/*
+ * function get_varsize
+ *
+ * Read size which put_varsize() saved, in len bytes of in.
+ *
+ * Returns:
+ *      Number of bytes read, or -1 if broken.
+ */
+int get_varsize(unsigned char *in, int len, long long *size)
+{
+  unsigned long long u = 0;
+  int n;
+  for (n=0; n<len && n<VARSIZE_MAXSIZE; n++) {
+    if (n == VARSIZE_MAXSIZE-1 && (in[n] & 0x7f) > 1) return -1;  // only bit 63 is left
+    u |= (unsigned long long)(in[n] & 0x7f) << (7*n);
+    if ((in[n] & 0x80) == 0) {
+      if (u > LLONG_MAX) return -1;
+      *size = u;
+      return n + 1;
+    }
+  }
+  return -1;
+}
+
+/*
+ * function get_lengths
+ *
+ * Read code lengths which put_lengths() saved to lengths of c. Lengths
+ * of more codes than a prefix code can have, which only a broken file
+ * has, are refused, as the decoding table has no room for them.
+ *
+ * Returns:
+ *      Number of bytes read, or -1 if size is too small or lengths are
+ *      broken.
+ */
+int get_lengths(unsigned char *in, int size, code_pointer c)
+{
+  int i, n = 32, nibble = 0, kraft = 0;
+
+  if (size < 32) return -1;
+  for (i=0; i<256; i++) {
+    if ((in[i/8] & (0x80 >> (i%8))) == 0) {  // not appeared
+      c->bitlength[i] = 0;
+      continue;
+    }
+    if (n >= size) return -1;
+    if (nibble == 0) c->bitlength[i] = in[n] >> 4;
+    else c->bitlength[i] = in[n++] & 0xf;
+    nibble ^= 1;
+    if (c->bitlength[i] != 0) kraft += 1 << (15 - c->bitlength[i]);  // share of codes, of 2^15
+  }
+  if (kraft > 1 << 15) return -1;
+  return n + nibble;
+}
+
+/*
+ * function make_huffcode
+ * 
+ * Makes huffman code from huffman tree recursively.
+ * Encoding binary files has some difficulties.
+ *
+ * Input: Index of huffman tree root node in tree
+ * 
+ * Really Really Worst case :::::::
+ *
+ *     one '\0', two '\1's, four '\2's, eight '\3's ...
+ *     2^i for '\i' for all character set.
+ *     
+ *     one + two < four, one + two + four < eight . . .
+ *     
+ *     Huffman code for '\0' is "0000000 ... 0000000", that's 255 zeros.
+ *     Huffman code for '\1' is "0000000 ... 0000001", that's 254 zeros and 1 one.
+ *     Huffman code for '\2' is "0000000 ... 000001" , that's 253 zeros and 1 one.
+ *     
+ *     So maximum size of huffman code is 255.
+ *
+ * So we must use array of int for huffman code.
+ * (Actually I made it.....)
+ * BUT..... I realized that it exceed 2 Giga byte, if huffman code is longer than 32 bits.
+ * So huffcode for one character is just one integer. (T.T) I deleted all code for multi-
+ * integer sized huffman code.
+ *
+ * Now make_hufftree() limits the tree depth to MAX_CODELEN (or maxbits
+ * if set), so huffcode doesn't overflow even in the really worst case.
+ *
+ */
+void make_huffcode(int tn)
+{
+  if (tree[tn].left < 0) {  // if leaf node
+    filecode.bitlength[(int)tree[tn].c] = tmplen;  // save bit length and
+    filecode.huffcode[(int)tree[tn].c] = tmpcode;  // huffman code
+    return;
+  }
+
+  /* before recursion to the left */
+  tmpcode = tmpcode << 1;  // add bit 0
+  tmplen++;
+
+  /* recursion to the left */
+  make_huffcode(tree[tn].left);
+
+  /* before recursion to the right */
+  tmpcode = tmpcode | 1;  // add bit 1
+
+  /* recursion to the right */
+  if (tree[tn].right >= 0) make_huffcode(tree[tn].right);
+
+  /* recover values after recursions */
+  tmplen--;
+  tmpcode = tmpcode >> 1;
+}
+
+/*
+ * function make_canonical
+ *
+ * Make canonical huffman code of c from its lengths. Codes of the same length
+ * are consecutive numbers in character order, and the first code of
+ * each length follows the last code of the shorter length, one bit
+ * longer. So the codes are known from the lengths only, and the
+ * decoder doesn't need frequencies or the huffman tree.
+ *
+ * Example: lengths a=2, b=1, c=3, d=3 make b=0, a=10, c=110, d=111.
+ *
+ * Codes of each length are counted first, so the first code of each
+ * length is known and characters are visited only once.
+ */
+void make_canonical(code_pointer c)
+{
+  unsigned int code = 0, next[MAX_CODELEN+1];
+  int count[MAX_CODELEN+1], i, l;
+  for (l=0; l<=MAX_CODELEN; l++) count[l] = 0;
+  for (i=0; i<256; i++) count[c->bitlength[i]]++;
+  for (l=1; l<=MAX_CODELEN; l++) {  // first code of each length
+    next[l] = code;
+    code = (code + count[l]) << 1;
+  }
+  for (i=0; i<256; i++)
+    if (c->bitlength[i] != 0) c->huffcode[i] = next[c->bitlength[i]]++;
+}
+
+/*
+ * function leaf_depth
+ *
+ * Save depth of each leaf node under tn to len recursively.
+ */
+static void leaf_depth(int tn, int depth, int *len)
+{
+  if (tree[tn].left < 0) {  // if leaf node
+    len[(int)tree[tn].c] = depth;
+    return;
+  }
+  leaf_depth(tree[tn].left, depth+1, len);
+  if (tree[tn].right >= 0) leaf_depth(tree[tn].right, depth+1, len);
+}
+
+/*
+ * function new_tnode
+ *
+ * Take a new node from tree and initialize it. Nodes are not freed one
+ * by one, the whole tree is dropped by setting treesize to 0.
+ *
+ * Arguments:
+ *      long long frq - Frequency data of new tree node.
+ *      unsigned char c - character data of new tree node.
+ *          Non-leaf tree node has NULL character.
+ *      int left, right - index of left and right node of the node, -1
+ *          if none. Bit 0 to the left node, bit 1 to the right node.
+ *
+ * Returns:
+ *      Index of the new node in tree.
+ */
+static int new_tnode(long long frq, unsigned char c, int left, int right)
+{
+  tree[treesize].frq = frq;
+  tree[treesize].c = c;
+  tree[treesize].left = left;
+  tree[treesize].right = right;
+  return treesize++;
+}
+
+/*
+ * function limit_lengths
+ *
+ * If some of code lengths len are longer than the limit, change them
+ * to lengths that are not, so that huffcode never overflows and
+ * decoding tables can have fixed width.
+ *
+ * 1. Count codes of each length. Codes longer than the limit are
+ *    counted as the limit length.
+ * 2. Now there are too many codes to be a prefix code, so move the
+ *    longest code shorter than the limit one bit longer, until Kraft
+ *    sum (sum of 2^(limit-length)) is not over 2^limit.
+ * 3. If Kraft sum is under 2^limit, move longest codes one bit
+ *    shorter while they fit, not to waste code space.
+ * 4. Give shorter lengths to more frequent characters.
+ *
+ * The new lengths only depend on frequencies counts and limit, so
+ * huffenc, huffdec and frqdump make the same lengths.
+ *
+ * Returns:
+ *      1 if lengths are changed, 0 if not.
+ */
+static int limit_lengths(int *len, long long *counts, int limit)
+{
+  int count[MAX_CODELEN+2], order[256];
+  int i, j, l, n=0, tmp;
+  long long kraft=0, full=1LL << limit;
+
+  for (i=0; i<256; i++)
+    if (len[i] > limit) break;
+  if (i == 256) return 0;  // not longer than limit
+
+  /* 1. count codes of each length */
+  for (l=0; l<=limit+1; l++) count[l] = 0;
+  for (i=0; i<256; i++) {
+    if (len[i] == 0) continue;
+    l = (len[i] > limit ? limit : len[i]);
+    count[l]++;
+    kraft += full >> l;
+    order[n++] = i;
+  }
+  /* 2. make it a prefix code */
+  while (kraft > full) {
+    for (l=limit-1; count[l]==0; l--) ;
+    count[l]--;
+    count[l+1]++;
+    kraft -= full >> (l+1);
+  }
+  /* 3. use remained code space */
+  for (l=limit; l>1; l--) {
+    while (count[l] > 0 && kraft + (full >> l) <= full) {
+      count[l]--;
+      count[l-1]++;
+      kraft += full >> l;
+    }
+  }
+  /* 4. sort characters by frequency, more frequent first */
+  for (i=1; i<n; i++) {  // insertion sort, stable for same frequency
+    tmp = order[i];
+    for (j=i; j>0 && counts[order[j-1]] < counts[tmp]; j--) order[j] = order[j-1];
+    order[j] = tmp;
+  }
+  for (i=0, l=1; i<n; i++) {
+    while (count[l] == 0) l++;
+    len[order[i]] = l;
+    count[l]--;
+  }
+  return 1;
+}
+
+/*
+ * function limit_hufftree
+ *
+ * If the huffman tree is deeper than the limit, change it to a tree
+ * that is not. The limit is maxbits, or MAX_CODELEN (bits of huffcode)
+ * if maxbits is 0. Lengths are limited by limit_lengths(), then
+ * canonical codes are made from the lengths by make_canonical(), and
+ * a new tree is made from the codes.
+ */
+static void limit_hufftree()
+{
+  int *len = filecode.bitlength, *code = filecode.huffcode;
+  int i, j, tn;
+
+  if (tree[root].left < 0) return;  // empty file
+  for (i=0; i<256; i++) len[i] = 0;
+  leaf_depth(root, 0, len);
+  if (!limit_lengths(len, frq, (maxbits != 0 ? maxbits : MAX_CODELEN)))
+    return;  // not deeper than limit
+
+  make_canonical(&filecode);
+  treesize = 0;  // drop the old tree
+  root = new_tnode(0, '\0', -1, -1);
+  for (i=0; i<256; i++) {
+    if (len[i] == 0) continue;
+    tn = root;
+    for (j=len[i]-1; j>0; j--) {  // go down to the parent of the leaf
+      if ((((unsigned int)code[i] >> j) & 1) == 0) {
+        if (tree[tn].left < 0) tree[tn].left = new_tnode(0, '\0', -1, -1);
+        tn = tree[tn].left;
+      }
+      else {
+        if (tree[tn].right < 0) tree[tn].right = new_tnode(0, '\0', -1, -1);
+        tn = tree[tn].right;
+      }
+    }
+    if ((code[i] & 1) == 0) tree[tn].left = new_tnode(frq[i], (unsigned char)i, -1, -1);
+    else tree[tn].right = new_tnode(frq[i], (unsigned char)i, -1, -1);
+  }
+}
+
+/*
+ * function heap_add
+ *
+ * Add node n of tree to min heap of size nodes.
+ *  1. Add new node at the end of the heap.
+ *  2. Percolate up from the added node.
+ *
+ * How to Percolate Up:
+ *  1. Comapare (i)th and PARENT node frequency.
+ *  2. If PARENT node frequency is bigger, swap them.
+ *  3. Change i to its PARENT.
+ */
+static void heap_add(int *heap, int *size, int n)
+{
+  int i = (*size)++, tmp;
+  heap[i] = n;  // Add new node at the end of the heap
+  while (i>0) {  // percolate up until root
+    if (tree[heap[i]].frq < tree[heap[(i-1)/2]].frq) {  // if PARENT is bigger
+      tmp = heap[i];
+      heap[i] = heap[(i-1)/2];  // swap
+      heap[(i-1)/2] = tmp;
+      i = (i-1)/2;  // change i to PARENT
+    }
+    else break;
+  }
+}
+
+/*
+ * function heap_remove
+ *
+ * Remove the minimum node from min heap of size nodes.
+ *  1. Remove the root element of heap. (heap[0])
+ *  2. Move the last node to root.
+ *  3. Percolate down from the root.
+ *
+ * How to percolate down:
+ *  1. Compare left and right child, and set 'smaller' to smaller one.
+ *  2. Compare (i)th and (smaller)th node frequency.
+ *  3. if (smaller)th node is smaller, swap them.
+ *  4. Change i to smaller.
+ *
+ * Returns:
+ *      Index of the minimum frequency tree node, -1 if heap is empty.
+ */
+static int heap_remove(int *heap, int *size)
+{
+  int i=0, n, tmp, smaller;
+  if (*size <= 0) return -1;  // Heap empty returns -1
+  n = heap[0];  // Remove the root element of heap
+  heap[0] = heap[--(*size)];  // Move the last node to root.
+  while (2*i+1 < *size) {  // Percolate down until leaf node
+    if (2*i+2 == *size) {  // If single child
+      if (tree[heap[2*i+1]].frq < tree[heap[i]].frq) {  // if child is smaller
+        tmp = heap[2*i+1];
+        heap[2*i+1] = heap[i];  // change them
+        heap[i] = tmp;
+      }
+      break;
+    }
+    smaller = (tree[heap[2*i+1]].frq < tree[heap[2*i+2]].frq ? 2*i+1 : 2*i+2);
+    if (tree[heap[i]].frq > tree[heap[smaller]].frq) {  // if smaller child is smaller than i
+      tmp = heap[i];
+      heap[i] = heap[smaller];  // change i and smaller
+      heap[smaller] = tmp;
+      i = smaller;
+    }
+    else break;
+  }
+  return n;
+}
+
+/*
+ * function make_hufftree
+ *
+ * Make huffman tree of frq using heap.
+ *
+ * 1. For all character set, if frequency is over 0, make new tree node
+ *    and put it in min heap.
+ * 2. Make new tree node and get 2 items from min heap.
+ * 3. Set 2 items as left and right node of the new tree node.
+ * 4. Repeat number 2 and number 3 until heap contains only one item.
+ * 5. Then the remained tree node is the root node of whole huffman tree.
+ *
+ * If only 1 character set exists set it as huffcode 0.
+ * root -> left = (the only tnode), root->right = -1.
+ * ** Takes left node we can check leaf node if left node is -1.
+ *
+ * If no character set exists (empty file)
+ * root -> left = -1, root -> right = -1.
+ *
+ * The frequency file saves no tree, so huffdec must make the same tree
+ * as huffenc, with the same order of nodes in the heap. Then
+ * limit_hufftree() makes sure no code is longer than maxbits, or
+ * MAX_CODELEN if maxbits is 0.
+ */
+void make_hufftree()
+{
+  int heap[256], size=0, tn1, tn2, i;
+
+  treesize = 0;  // nodes are taken from tree in order
+  for (i=0; i<256; i++)  // for each character set
+    if (frq[i] > 0)   // if frequency is over 0, add new tnode to heap
+      heap_add(heap, &size, new_tnode(frq[i], (unsigned char)i, -1, -1));
+
+  if (size <= 1)  // if heap size is not greater than 1
+    root = new_tnode(0, '\0', heap_remove(heap, &size), -1);
+    /* root->left=(the only tnode), root->right=-1
+     * If no items are in heap, heap_remove() returns -1
+     * So both case OK.
+     */
+  else {
+    while (size > 1) {  // loop
+      tn1 = heap_remove(heap, &size);  // get 2 items from heap
+      tn2 = heap_remove(heap, &size);
+      heap_add(heap, &size, new_tnode(tree[tn1].frq+tree[tn2].frq, '\0', tn1, tn2));
+      // add new node that has 2 children
+    }
+    root = heap_remove(heap, &size);  // remainded node is root node of whole hufftree
+  }
+  limit_hufftree();  // limit code length
+}
+
+/*
+ * function make_lengths
+ *
+ * Make huffman code lengths len of n symbols from their frequencies
+ * counts, without tree nodes. Each symbol that appears gets the key
+ * frequency * 2^bits + symbol, where 2^bits >= n, and keys are sorted
+ * by radix sort, a byte at a time, so less frequent symbols come first
+ * and the same frequencies are ordered by symbol. Then the lengths are
+ * computed in place, by the algorithm of Moffat and Katajainen:
+ *
+ * 1. Left to right, pair the two smallest of the leaves not taken yet
+ *    and the internal nodes made before. Internal nodes are made in
+ *    order of frequency, so they are a queue too, and no heap is
+ *    needed. Each taken internal node saves the index of its parent.
+ * 2. Right to left, set depth of each internal node from its parent.
+ * 3. Right to left, count internal nodes at each depth, and set depths
+ *    of the leaves from the free places.
+ *
+ * Everything takes O(n). work is 2*n items from the caller, so nothing
+ * is allocated and n is not limited to 256. Frequencies must be less
+ * than 2^(63-bits). A symbol which appears alone gets length 1, as from
+ * make_hufftree().
+ */
+void make_lengths(long long *counts, int n, int *len, long long *work)
+{
+  long long *a = work, *sym = work + n, *tmp, max = 0, mask;
+  int pos[256], i, k, t, m=0, bits, shift, root, leaf, next, avbl, used, depth;
+
+  for (bits=0; (1LL << bits) < n; bits++) ;
+  mask = (1LL << bits) - 1;
+  for (i=0; i<n; i++) {
+    len[i] = 0;
+    if (counts[i] == 0) continue;
+    a[m] = (counts[i] << bits) | i;
+    if (a[m] > max) max = a[m];
+    m++;
+  }
+  if (m == 0) return;
+  if (m == 1) {
+    len[a[0] & mask] = 1;
     return;
   }
-  while (h->size > 1) {  // loop
-    tn1 = heap_remove(h);  // get 2 items from heap
-    tn2 = heap_remove(h);
-    heap_add(h, new_tnode(tn1->frq+tn2->frq, '\0', tn1, tn2));
-    // add new node that has 2 children
+  for (shift=0; (max >> shift) != 0; shift += 8) {  // radix sort, the lowest byte first
+    for (i=0; i<256; i++) pos[i] = 0;
+    for (i=0; i<m; i++) pos[(a[i] >> shift) & 0xff]++;
+    for (i=0, k=0; i<256; i++) {  // first place of each byte
+      t = pos[i];
+      pos[i] = k;
+      k += t;
+    }
+    for (i=0; i<m; i++) sym[pos[(a[i] >> shift) & 0xff]++] = a[i];
+    tmp = a;  // sorted keys are in sym, swap
+    a = sym;
+    sym = tmp;
+  }
+  for (i=0; i<m; i++) {  // split keys to symbols and frequencies
+    sym[i] = a[i] & mask;
+    a[i] >>= bits;
+  }
+
+  /* 1. pair nodes, saving parents */
+  a[0] += a[1];
+  root = 0;
+  leaf = 2;
+  for (next=1; next < m-1; next++) {
+    if (leaf >= m || a[root] < a[leaf]) {  // first of the pair
+      a[next] = a[root];
+      a[root++] = next;
+    }
+    else a[next] = a[leaf++];
+    if (leaf >= m || (root < next && a[root] < a[leaf])) {  // second of the pair
+      a[next] += a[root];
+      a[root++] = next;
+    }
+    else a[next] += a[leaf++];
+  }
+  /* 2. depths of internal nodes */
+  a[m-2] = 0;
+  for (next=m-3; next>=0; next--) a[next] = a[a[next]] + 1;
+  /* 3. depths of leaves */
+  avbl = 1;
+  used = depth = 0;
+  root = m-2;
+  next = m-1;
+  while (avbl > 0) {
+    while (root >= 0 && a[root] == depth) {
+      used++;
+      root--;
+    }
+    while (avbl > used) {
+      a[next--] = depth;
+      avbl--;
+    }
+    avbl = 2*used;
+    depth++;
+    used = 0;
+  }
+  for (i=0; i<m; i++) len[sym[i]] = a[i];
+}
+
+/*
+ * function make_blockcode
+ *
+ * Make canonical huffman code c of one block from its frequencies
+ * counts, with lengths up to limit. Lengths are made by make_lengths(),
+ * with no tree and no malloc, as it runs for every block. Uses no
+ * global variables, so blocks can make their codes at the same time on
+ * threads.
+ */
+void make_blockcode(long long *counts, code_pointer c, int limit)
+{
+  long long work[2*256];
+
+  make_lengths(counts, 256, c->bitlength, work);
+  limit_lengths(c->bitlength, counts, limit);
+  make_canonical(c);
+}
+
+/*
+ * function code_bits
+ *
+ * Returns:
+ *      Number of bits characters of frequencies counts take when they
+ *      are encoded by code c, or -1 if some of them have no code in c.
+ */
+long long code_bits(long long *counts, code_pointer c)
+{
+  long long bits = 0;
+  int i;
+  for (i=0; i<256; i++) {
+    if (counts[i] == 0) continue;
+    if (c->bitlength[i] == 0) return -1;
+    bits += counts[i] * c->bitlength[i];
+  }
+  return bits;
+}
+
+/*
+ * function new_subtable
+ *
+ * Append a new table of 2^bits empty entries to the decoding table t.
+ *
+ * Returns:
+ *      Offset of the new table in the decoding table.
+ */
+static int new_subtable(dectable_pointer t, int bits)
+{
+  int offset = t->size;
+  if (offset + (1 << bits) > t->alloc) {  // grow entries
+    t->alloc = offset + (1 << bits);
+    t->entry = realloc(t->entry, t->alloc * sizeof(dentry_struct));
+    if (t->entry == NULL) {
+      fprintf(stderr, "Out of memory!\n");
+      exit(1);
+    }
+  }
+  t->size += 1 << bits;
+  memset(t->entry + offset, 0, (1 << bits) * sizeof(dentry_struct));
+  return offset;
+}
+
+/*
+ * function fill_dectable
+ *
+ * Fill a table of 2^bits entries of t for all codes of c that start
+ * with 'prefix', which is 'base' bits long. Codes that fit in the table
+ * fill all entries they are a prefix of. Longer codes are linked to
+ * sub tables, one for each group of codes sharing the next 'bits'
+ * bits, and the sub tables are filled recursively.
+ *
+ * Returns:
+ *      Offset of the filled table in the decoding table.
+ */
+static int fill_dectable(dectable_pointer t, code_pointer c, unsigned int prefix, int base, int bits)
+{
+  int offset = new_subtable(t, bits);
+  int sublen[1 << DEC_TABLE_BITS];  // longest remained length for each link
+  int i, j, rem, index, next;
+  unsigned int code;
+
+  for (i=0; i < (1 << bits); i++) sublen[i] = 0;
+  for (i=0; i<256; i++) {
+    if (c->bitlength[i] <= base) continue;  // not in this table
+    code = (unsigned int)c->huffcode[i];
+    if (base > 0 && (code >> (c->bitlength[i]-base)) != prefix) continue;
+    rem = c->bitlength[i] - base;  // bits remained after the prefix
+    code &= (unsigned int)((1ULL << rem) - 1);
+    if (rem <= bits) {  // code fits in the table
+      index = code << (bits-rem);
+      for (j=0; j < (1 << (bits-rem)); j++) {
+        t->entry[offset+index+j].c = (unsigned char)i;
+        t->entry[offset+index+j].len = rem;
+      }
+    }
+    else {  // code needs a sub table
+      index = code >> (rem-bits);
+      if (rem-bits > sublen[index]) sublen[index] = rem-bits;
+    }
+  }
+  for (i=0; i < (1 << bits); i++) {
+    if (sublen[i] == 0) continue;
+    if (sublen[i] > DEC_TABLE_BITS) sublen[i] = DEC_TABLE_BITS;
+    next = fill_dectable(t, c, (prefix << bits) | i, base+bits, sublen[i]);
+    // new_subtable() may move entries, so index them again.
+    t->entry[offset+i].len = bits;
+    t->entry[offset+i].bits = sublen[i];
+    t->entry[offset+i].next = next;
+  }
+  return offset;
+}
+
+/*
+ * function make_dectable
+ *
+ * Make the decoding table t from code c, such as filecode which
+ * make_huffcode made. Instead of walking the huffman tree one bit at a
+ * time, the decoder looks up DEC_TABLE_BITS bits at once and gets the
+ * character and its code length from one entry.
+ *
+ * Codes not longer than DEC_TABLE_BITS are decoded by one lookup.
+ * Longer codes share their first DEC_TABLE_BITS bits with some other
+ * long codes, so the entry links to a sub table for the next bits.
+ * Sub tables are only as wide as their longest code needs, so the whole
+ * table stays small even for the really worst case codes.
+ *
+ * The root table starts at offset 0. t->maxlen is set to the longest
+ * code length, so the decoder knows how many bits must be loaded before
+ * decoding one character. Entries t already has are reused.
+ *
+ * If t->maxlen is not longer than DEC_FAST_MAXBITS, the flat table is
+ * made too, 8, 11 or 15 bits wide, as narrow as the longest code
+ * allows, so it stays in L1 cache for short codes. decode_streams()
+ * has a kernel for each of these widths. Filling the flat table takes
+ * a write for each entry, so it is made only if the table decodes at
+ * least DEC_FAST_MINCHARS characters, chars, or 0 if not known.
+ */
+void make_dectable(dectable_pointer t, code_pointer c, long long chars)
+{
+  int i, j, len, index;
+  t->size = 0;
+  t->maxlen = 0;
+  for (i=0; i<256; i++)
+    if (c->bitlength[i] > t->maxlen) t->maxlen = c->bitlength[i];
+  fill_dectable(t, c, 0, 0, DEC_TABLE_BITS);
+
+  t->fastbits = 0;
+  if (t->generic || t->maxlen > DEC_FAST_MAXBITS) return;
+  t->fastbits = (t->maxlen <= 8 ? 8 : t->maxlen <= 11 ? 11 : 15);
+  if (chars != 0 && chars < DEC_FAST_MINCHARS(t->fastbits)) {  // not worth filling
+    t->fastbits = 0;
+    return;
+  }
+  if ((1 << t->fastbits) > t->fastalloc) {  // grow flat table
+    t->fastalloc = 1 << t->fastbits;
+    t->fast = realloc(t->fast, t->fastalloc * sizeof(unsigned short));
+    if (t->fast == NULL) {
+      fprintf(stderr, "Out of memory!\n");
+      exit(1);
+    }
+  }
+  memset(t->fast, 0, (1 << t->fastbits) * sizeof(unsigned short));
+  for (i=0; i<256; i++) {
+    len = c->bitlength[i];
+    if (len == 0) continue;
+    index = (unsigned int)c->huffcode[i] << (t->fastbits - len);
+    for (j=0; j < (1 << (t->fastbits - len)); j++)
+      t->fast[index+j] = (unsigned short)(len << 8 | i);
+  }
+}
+
+/*
+ * function free_dectable
+ *
+ * Free entries of t made by make_dectable().
+ */
+void free_dectable(dectable_pointer t)
+{
+  free(t->entry);
+  free(t->fast);
+  t->entry = NULL;
+  t->fast = NULL;
+  t->size = t->alloc = t->fastalloc = 0;
+}
+
+/* append the top-first code v of l bits to bits */
+#define PUTWORD(v, l) \
+  count += (l); \
+  bits |= (unsigned long long)(v) << (64-count)
+/* append the code of one character */
+#define PUTCODE(ch) PUTWORD((unsigned int)huffcode[ch], bitlength[ch])
+/* write full bytes of bits, most significant byte first */
+#define PUTBYTES \
+  out[o] = bits >> 56; out[o+1] = bits >> 48; \
+  out[o+2] = bits >> 40; out[o+3] = bits >> 32; \
+  out[o+4] = bits >> 24; out[o+5] = bits >> 16; \
+  out[o+6] = bits >> 8; out[o+7] = bits; \
+  o += count >> 3; \
+  bits = (count >> 3) == 8 ? 0 : bits << (count & ~7); \
+  count &= 7
+
+#ifdef PACK_HAVE_AVX2
+/*
+ * function pack_avx2
+ *
+ * The vector loop of pack_codes() for codes of at most 28 bits. Codes
+ * and lengths of 8 input bytes are gathered at once. Each code is
+ * shifted by the length of the codes after it and merged in 64 bit
+ * lanes, two codes per lane, then four codes per lane if no code is
+ * longer than 14 bits, so the offset of each code is the sum of the
+ * lengths before it. The merged words are appended to pk->bits as
+ * pack_codes() appends codes, so the output is the same.
+ *
+ * Returns:
+ *      Number of input bytes encoded, a multiple of 8.
+ */
+__attribute__((target("avx2")))
+static int pack_avx2(packer_pointer pk, code_pointer c, unsigned char *in, int insize,
+                     unsigned char *out, int *outsize, int outcap, int maxlen)
+{
+  __m256i low = _mm256_set1_epi64x(0xffffffff), idx, len, code, wl, wc;
+  unsigned long long bits = pk->bits, w[4], l[4];
+  int count = pk->count, o = *outsize, i = 0;
+
+  // 4 stores of at most 7 bytes and the last 8 byte store
+  while (i + 8 <= insize && o + 4*PACK_SLACK <= outcap) {
+    idx = _mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i *)(in+i)));
+    len = _mm256_i32gather_epi32(c->bitlength, idx, 4);
+    code = _mm256_i32gather_epi32(c->huffcode, idx, 4);
+    // code 2j in the low half of lane j goes before code 2j+1
+    wl = _mm256_add_epi64(_mm256_and_si256(len, low), _mm256_srli_epi64(len, 32));
+    wc = _mm256_sllv_epi64(_mm256_and_si256(code, low), _mm256_srli_epi64(len, 32));
+    wc = _mm256_or_si256(wc, _mm256_srli_epi64(code, 32));
+    if (maxlen <= 14) {  // lane 2j+1 after lane 2j, in lanes 0 and 2
+      wc = _mm256_or_si256(_mm256_sllv_epi64(wc, _mm256_srli_si256(wl, 8)),
+                           _mm256_srli_si256(wc, 8));
+      wl = _mm256_add_epi64(wl, _mm256_srli_si256(wl, 8));
+    }
+    _mm256_storeu_si256((__m256i *)w, wc);
+    _mm256_storeu_si256((__m256i *)l, wl);
+    if (maxlen <= 14) {
+      PUTWORD(w[0], l[0]);
+      PUTBYTES;
+      PUTWORD(w[2], l[2]);
+      PUTBYTES;
+    }
+    else {
+      PUTWORD(w[0], l[0]);
+      PUTBYTES;
+      PUTWORD(w[1], l[1]);
+      PUTBYTES;
+      PUTWORD(w[2], l[2]);
+      PUTBYTES;
+      PUTWORD(w[3], l[3]);
+      PUTBYTES;
+    }
+    i += 8;
+  }
+  pk->bits = bits;
+  pk->count = count;
+  *outsize = o;
+  return i;
+}
+#endif
+
+/*
+ * function pack_path
+ *
+ * Path of pack_codes() by packpath and the CPU.
+ *
+ * Returns:
+ *      PACK_AVX2 if packpath asks for it, or chooses by the CPU and
+ *      PACK_AUTO_AVX2 is 1, and the CPU has AVX2. PACK_SCALAR if not.
+ */
+int pack_path()
+{
+#ifdef PACK_HAVE_AVX2
+  if ((packpath == PACK_AVX2 || (packpath == PACK_AUTO && PACK_AUTO_AVX2)) &&
+      __builtin_cpu_supports("avx2"))
+    return PACK_AVX2;
+#endif
+  return PACK_SCALAR;
+}
+
+/*
+ * function pack_codes
+ *
+ * Append huffman codes c of input bytes to the output buffer.
+ *
+ * Whole codes are appended to the 64 bit pk->bits at once, the first
+ * bit at the top. After appending, all full bytes of pk->bits are
+ * written with one 8 byte store and shifted out, so at most 7 bits
+ * stay. If no code is longer than 14 bits, four codes fit in pk->bits
+ * together, and full bytes are written only once for four codes, or
+ * for two codes if none is longer than 28 bits, such as codes of the
+ * default limit of 15 bits. Otherwise one code (at most 32 bits,
+ * huffcode is int) is appended at a time. Codes of at most 28 bits
+ * are merged 8 at a time by pack_avx2() instead, if pack_path() says
+ * so. Bits which don't fill a byte stay in pk for the next call, so
+ * the output is the same as writing bit by bit.
+ *
+ * Arguments:
+ *      packer_pointer pk - bits not written yet, 0 bits at first.
+ *      code_pointer c - huffman code, such as filecode.
+ *      unsigned char *in, int insize - input bytes to encode.
+ *      unsigned char *out - output buffer.
+ *      int *outsize - bytes already in out, increased by written bytes.
+ *      int outcap - size of out. Packing stops when less than
+ *          PACK_SLACK bytes are left, as the 8 byte store needs them.
+ *
+ * Returns:
+ *      Number of input bytes encoded.
+ */
+int pack_codes(packer_pointer pk, code_pointer c, unsigned char *in, int insize, unsigned char *out, int *outsize, int outcap)
+{
+  unsigned long long bits;
+  int *bitlength = c->bitlength, *huffcode = c->huffcode;
+  int count, o, i = 0, maxlen = 0;
+
+  for (i=0; i<256; i++)
+    if (bitlength[i] > maxlen) maxlen = bitlength[i];
+  i = 0;
+#ifdef PACK_HAVE_AVX2
+  if (maxlen <= 28 && pack_path() == PACK_AVX2)
+    i = pack_avx2(pk, c, in, insize, out, outsize, outcap, maxlen);
+#endif
+  bits = pk->bits;
+  count = pk->count;
+  o = *outsize;
+
+  if (maxlen <= 14) {  // four codes fit with 7 remained bits
+    while (i + 4 <= insize && o + PACK_SLACK <= outcap) {
+      PUTCODE(in[i]);
+      PUTCODE(in[i+1]);
+      PUTCODE(in[i+2]);
+      PUTCODE(in[i+3]);
+      PUTBYTES;
+      i += 4;
+    }
+  }
+  else if (maxlen <= 28) {  // two codes fit with 7 remained bits
+    while (i + 2 <= insize && o + PACK_SLACK <= outcap) {
+      PUTCODE(in[i]);
+      PUTCODE(in[i+1]);
+      PUTBYTES;
+      i += 2;
+    }
+  }
+  while (i < insize && o + PACK_SLACK <= outcap) {
+    PUTCODE(in[i]);
+    PUTBYTES;
+    i++;
+  }
+  pk->bits = bits;
+  pk->count = count;
+  *outsize = o;
+  return i;
+}
+#undef PUTWORD
+#undef PUTCODE
+#undef PUTBYTES
+
+/*
+ * function flush_codes
+ *
+ * Write bits remained in pk, padding the last byte with 0 bits.
+ *
+ * Returns:
+ *      Number of bytes written.
+ */
+int flush_codes(packer_pointer pk, unsigned char *out)
+{
+  int n = 0;
+  if (pk->count > 0) out[n++] = (unsigned char)(pk->bits >> 56);
+  pk->bits = 0;
+  pk->count = 0;
+  return n;
+}
+
+/*
+ * function encode_streams
+ *
+ * Encode one block by code c into nstreams interleaved streams. Character i of
+ * the block goes to stream i % nstreams, so each stream can be decoded
+ * independently of the others, and the decoder decodes one character
+ * of each stream in turn without waiting for the previous one.
+ *
+ * Block Structure :::
+ *  Size of each stream in bytes, 4 bytes each, least significant byte
+ *  first. Then each stream, packed by pack_codes() and padded to a
+ *  byte.
+ *
+ * Arguments:
+ *      code_pointer c - huffman code, such as filecode.
+ *      int nstreams - number of streams, 1, 2, 4 or 8.
+ *      unsigned char *in, int insize - one block to encode.
+ *      unsigned char *out - output buffer, STREAMS_BOUND(insize) bytes.
+ *
+ * Returns:
+ *      Size of encoded block.
+ */
+int encode_streams(code_pointer c, int nstreams, unsigned char *in, int insize, unsigned char *out)
+{
+  unsigned char chunk[BUFSIZ];  // characters of one stream
+  packer_struct pk = { 0, 0 };
+  int i, k, n, start, size, o = 4*nstreams;
+
+  for (k=0; k<nstreams; k++) {  // for each stream
+    start = o;
+    i = k;
+    while (i < insize) {
+      for (n=0; n < BUFSIZ && i < insize; i += nstreams) chunk[n++] = in[i];
+      pack_codes(&pk, c, chunk, n, out, &o, o + 4*n + PACK_SLACK);
+    }
+    o += flush_codes(&pk, out+o);
+    size = o - start;
+    out[4*k] = size;  // save stream size
+    out[4*k+1] = size >> 8;
+    out[4*k+2] = size >> 16;
+    out[4*k+3] = size >> 24;
+  }
+  return o;
+}
+
+/*
+ * function check_streams
+ *
+ * Returns:
+ *      1 if sizes of nstreams streams saved by encode_streams() in the
+ *      block fill the block of size bytes exactly, 0 if broken.
+ */
+int check_streams(unsigned char *in, int size, int nstreams)
+{
+  unsigned int s;
+  int k;
+  size -= 4*nstreams;
+  if (size < 0) return 0;
+  for (k=0; k<nstreams; k++) {
+    s = in[4*k] | in[4*k+1] << 8 | in[4*k+2] << 16 | (unsigned int)in[4*k+3] << 24;
+    if (s > (unsigned int)size) return 0;
+    size -= s;
+  }
+  return size == 0;
+}
+
+/*
+ * function load_bits
+ *
+ * Returns:
+ *      8 bytes from p, the first byte at the most significant byte.
+ */
+static inline unsigned long long load_bits(unsigned char *p)
+{
+  return (unsigned long long)p[0] << 56 | (unsigned long long)p[1] << 48 |
+    (unsigned long long)p[2] << 40 | (unsigned long long)p[3] << 32 |
+    (unsigned long long)p[4] << 24 | (unsigned long long)p[5] << 16 |
+    (unsigned long long)p[6] << 8 | (unsigned long long)p[7];
+}
+
+/*
+ * function safe_chars
+ *
+ * Returns:
+ *      Number of characters each of n streams can surely decode with
+ *      the refill without branch, as 8 bytes can be loaded from p[k]
+ *      for each refill until then, with codes up to maxlen bits.
+ *      Bits decoded move p[k] by them, and refill takes 63 bits at
+ *      most, so each refill before p[k] + 8 passes end[k] is safe.
+ */
+static inline int safe_chars(unsigned char **p, unsigned char **end, int *count, int n, int maxlen)
+{
+  long long m = MAX_BLOCKSIZE, s;
+  int k;
+  for (k=0; k<n; k++) {
+    s = (8 * (long long)(end[k] - p[k]) - 127 + count[k]) / maxlen;
+    if (s < m) m = s;
+  }
+  return (m < 0 ? 0 : m);
+}
+
+/*
+ * function decode_interleaved
+ *
+ * Decode one character of each stream in turn, for n (1, 2, 4 or 8)
+ * streams. Called with constant n by decode_streams(), so the code for
+ * each stream is written out and the bit buffers stay in registers.
+ *
+ * The bit buffer is refilled before each character without branch: 8
+ * bytes are loaded at the next byte, and as many whole bytes as fit
+ * are taken, so the buffer has 56 to 63 bits. Loaded bits under them
+ * are loaded again next time, so they don't matter. Characters are
+ * decoded so only while safe_chars() finds that 8 bytes of each
+ * stream are left, and the bit buffers are saved to bits and count
+ * for decode_tail() to decode the rest.
+ *
+ * Returns:
+ *      Number of characters decoded.
+ */
+static inline int decode_interleaved(dentry_pointer table, unsigned char **p, unsigned char **end,
+                                     unsigned long long *bitsout, int *countout, int maxlen,
+                                     unsigned char *out, int outsize, int n)
+{
+  unsigned long long bits[MAX_STREAMS];  // bit buffer of each stream
+  int count[MAX_STREAMS];  // number of bits in bit buffer
+  dentry_pointer e;
+  int i = 0, k, m;
+
+  for (k=0; k<n; k++) {
+    bits[k] = 0;
+    count[k] = 0;
+  }
+
+/* decode one character of stream k to out[i+k] */
+#define DECODE_STREAM(k) \
+  bits[k] |= load_bits(p[k]) >> count[k];  /* refill */ \
+  p[k] += (63 - count[k]) >> 3; \
+  count[k] |= 56; \
+  e = &table[bits[k] >> (64-DEC_TABLE_BITS)]; \
+  while (e->bits != 0) {  /* if the code is longer than the table */ \
+    bits[k] <<= e->len; \
+    count[k] -= e->len; \
+    e = &table[e->next + (bits[k] >> (64-e->bits))]; \
+  } \
+  bits[k] <<= e->len; \
+  count[k] -= e->len; \
+  out[i+k] = e->c
+
+  while (i + n <= outsize) {
+    m = safe_chars(p, end, count, n, maxlen);
+    if (m == 0) break;
+    if (m > (outsize - i) / n) m = (outsize - i) / n;
+    for (; m > 0; m--, i+=n) {
+      DECODE_STREAM(0);
+      if (n >= 2) {
+        DECODE_STREAM(1);
+      }
+      if (n >= 4) {
+        DECODE_STREAM(2);
+        DECODE_STREAM(3);
+      }
+      if (n >= 8) {
+        DECODE_STREAM(4);
+        DECODE_STREAM(5);
+        DECODE_STREAM(6);
+        DECODE_STREAM(7);
+      }
+    }
+  }
+#undef DECODE_STREAM
+  for (k=0; k<n; k++) {
+    bitsout[k] = bits[k];
+    countout[k] = count[k];
+  }
+  return i;
+}
+
+/*
+ * function decode_fast
+ *
+ * Decode as decode_interleaved(), by the flat table fast of 2^w
+ * entries, for codes not longer than w bits. Called with constant n
+ * and w by decode_streams(), so each width has its own kernel.
+ *
+ * Each code is one lookup with no sub table, and 56 / w codes always
+ * fit in the 56 bits a refill gives at least, so each stream is
+ * refilled once for 56 / w characters, not for each character.
+ *
+ * Returns:
+ *      Number of characters decoded, a multiple of n * 56 / w.
+ */
+static inline int decode_fast(unsigned short *fast, unsigned char **p, unsigned char **end,
+                              unsigned long long *bitsout, int *countout, int maxlen,
+                              unsigned char *out, int outsize, int n, int w)
+{
+  unsigned long long bits[MAX_STREAMS];  // bit buffer of each stream
+  int count[MAX_STREAMS];  // number of bits in bit buffer
+  int r = 56 / w;  // characters decoded by one refill
+  unsigned int e;
+  int i = 0, j, k, m;
+
+  for (k=0; k<n; k++) {
+    bits[k] = 0;
+    count[k] = 0;
+  }
+
+/* refill the bit buffer of stream k, as decode_interleaved() */
+#define REFILL(k) \
+  bits[k] |= load_bits(p[k]) >> count[k]; \
+  p[k] += (63 - count[k]) >> 3; \
+  count[k] |= 56
+/* decode one character of stream k to out[o] */
+#define LOOKUP(k, o) \
+  e = fast[bits[k] >> (64-w)]; \
+  bits[k] <<= e >> 8; \
+  count[k] -= e >> 8; \
+  out[o] = e
+/* decode r characters of stream k by one refill */
+#define DECODE_STREAM(k) \
+  REFILL(k); \
+  for (j=0; j<r; j++) { \
+    LOOKUP(k, i + j*n + k); \
+  }
+
+  while (i + r*n <= outsize) {
+    m = safe_chars(p, end, count, n, maxlen) / r;  // refills of each stream
+    if (m == 0) break;
+    if (m > (outsize - i) / (r*n)) m = (outsize - i) / (r*n);
+    for (; m > 0; m--, i += r*n) {
+      DECODE_STREAM(0);
+      if (n >= 2) {
+        DECODE_STREAM(1);
+      }
+      if (n >= 4) {
+        DECODE_STREAM(2);
+        DECODE_STREAM(3);
+      }
+      if (n >= 8) {
+        DECODE_STREAM(4);
+        DECODE_STREAM(5);
+        DECODE_STREAM(6);
+        DECODE_STREAM(7);
+      }
+    }
+  }
+#undef REFILL
+#undef LOOKUP
+#undef DECODE_STREAM
+  for (k=0; k<n; k++) {
+    bitsout[k] = bits[k];
+    countout[k] = count[k];
+  }
+  return i;
+}
+
+/*
+ * function decode_width
+ *
+ * Decode by decode_fast() with constant width w, for n streams.
+ *
+ * Returns:
+ *      Number of characters decoded.
+ */
+static int decode_width(unsigned short *fast, unsigned char **p, unsigned char **end,
+                        unsigned long long *bits, int *count, int maxlen,
+                        unsigned char *out, int outsize, int n, int w)
+{
+  switch (n) {
+  case 1: return decode_fast(fast, p, end, bits, count, maxlen, out, outsize, 1, w);
+  case 2: return decode_fast(fast, p, end, bits, count, maxlen, out, outsize, 2, w);
+  case 4: return decode_fast(fast, p, end, bits, count, maxlen, out, outsize, 4, w);
+  default: return decode_fast(fast, p, end, bits, count, maxlen, out, outsize, 8, w);
+  }
+}
+
+/*
+ * function decode_tail
+ *
+ * Decode characters i to outsize of n streams, after a kernel stopped
+ * near the end of a stream, with the bit buffers it left. As
+ * decode_bits(), 8 bytes are loaded at once only while they are in the
+ * stream, and the last bytes are loaded one by one, with bit 0 after
+ * the end, so no byte after the stream is read.
+ */
+static void decode_tail(dentry_pointer table, unsigned char **p, unsigned char **end,
+                        unsigned long long *bits, int *count, unsigned char *out, int i, int outsize, int n)
+{
+  dentry_pointer e;
+  int k;
+
+  for (; i<outsize; i++) {
+    k = i % n;
+    if (end[k] - p[k] >= 8) {  // refill without branch
+      bits[k] |= load_bits(p[k]) >> count[k];
+      p[k] += (63 - count[k]) >> 3;
+      count[k] |= 56;
+    }
+    else {
+      if (count[k] < 64) bits[k] &= ~(~0ULL >> count[k]);  // clear bits loaded beyond count
+      for (; count[k] <= 56; p[k]++, count[k] += 8)
+        bits[k] |= (unsigned long long)(p[k] < end[k] ? *p[k] : 0) << (56 - count[k]);
+    }
+    e = &table[bits[k] >> (64-DEC_TABLE_BITS)];
+    while (e->bits != 0) {  // if the code is longer than the table
+      bits[k] <<= e->len;
+      count[k] -= e->len;
+      e = &table[e->next + (bits[k] >> (64-e->bits))];
+    }
+    bits[k] <<= e->len;
+    count[k] -= e->len;
+    out[i] = e->c;
+  }
+}
+
+/*
+ * function decode_streams
+ *
+ * Decode one block which encode_streams() encoded. Each stream has its
+ * own bit buffer, and one character of each stream is decoded in turn,
+ * so the lookups of different streams can run at the same time.
+ * Codes which fit the flat table of t are decoded by decode_fast(),
+ * others by decode_interleaved(), while 8 bytes of each stream are
+ * left, and the last characters by decode_tail().
+ *
+ * Sizes of streams must be checked by check_streams() first. No byte
+ * after a stream is read, so a broken block can't make decoding read
+ * beyond it, and it is found when a stream runs out of bits.
+ *
+ * Arguments:
+ *      dectable_pointer t - decoding table made by make_dectable().
+ *      int nstreams - number of streams, 1, 2, 4 or 8.
+ *      unsigned char *in - encoded block.
+ *      unsigned char *out, int outsize - decoded characters.
+ *
+ * Returns:
+ *      1 if decoded, 0 if codes of a stream run over its end.
+ */
+int decode_streams(dectable_pointer t, int nstreams, unsigned char *in, unsigned char *out, int outsize)
+{
+  unsigned char *p[MAX_STREAMS], *end[MAX_STREAMS];  // next byte and end of each stream
+  unsigned long long bits[MAX_STREAMS];  // bit buffers the kernel left
+  int count[MAX_STREAMS];
+  int k, i, maxlen = (t->maxlen > 0 ? t->maxlen : 1);
+  long long o = 4*nstreams;
+
+  for (k=0; k<nstreams; k++) {
+    p[k] = in + o;
+    o += in[4*k] | in[4*k+1] << 8 | in[4*k+2] << 16 | (unsigned int)in[4*k+3] << 24;
+    end[k] = in + o;
+  }
+  switch (t->fastbits) {  // kernel for the longest code length
+  case 8: i = decode_width(t->fast, p, end, bits, count, maxlen, out, outsize, nstreams, 8); break;
+  case 11: i = decode_width(t->fast, p, end, bits, count, maxlen, out, outsize, nstreams, 11); break;
+  case 15: i = decode_width(t->fast, p, end, bits, count, maxlen, out, outsize, nstreams, 15); break;
+  default:
+    switch (nstreams) {
+    case 1: i = decode_interleaved(t->entry, p, end, bits, count, maxlen, out, outsize, 1); break;
+    case 2: i = decode_interleaved(t->entry, p, end, bits, count, maxlen, out, outsize, 2); break;
+    case 4: i = decode_interleaved(t->entry, p, end, bits, count, maxlen, out, outsize, 4); break;
+    default: i = decode_interleaved(t->entry, p, end, bits, count, maxlen, out, outsize, 8); break;
+    }
+  }
+  decode_tail(t->entry, p, end, bits, count, out, i, outsize, nstreams);
+  for (k=0; k<nstreams; k++)
+    if (8 * (p[k] - end[k]) > count[k]) return 0;  // bits used beyond the end
+  return 1;
+}
+
+/*
+ * function decode_chars
+ *
+ * Decode characters by the flat table fast of 2^w entries, as
+ * decode_run() with constant w. The bit buffer is refilled once for
+ * 56 / w characters, while 8 bytes can be loaded from in.
+ */
+static inline long long decode_chars(unsigned short *fast, unsigned long long *bits, int *count,
+                                     unsigned char *in, long long insize, long long *used,
+                                     unsigned char *out, long long outsize, int w)
+{
+  unsigned long long b = *bits;
+  unsigned char *p = in;
+  int c = *count, r = 56 / w, j;
+  unsigned int e;
+  long long o = 0;
+
+  while (insize - (p - in) >= 8 && o + r <= outsize) {
+    b |= load_bits(p) >> c;  // refill, as decode_interleaved()
+    p += (63 - c) >> 3;
+    c |= 56;
+    for (j=0; j<r; j++) {
+      e = fast[b >> (64-w)];
+      b <<= e >> 8;
+      c -= e >> 8;
+      out[o+j] = e;
+    }
+    o += r;
+  }
+  *bits = b;
+  *count = c;
+  *used = p - in;
+  return o;
+}
+
+/*
+ * function decode_run
+ *
+ * Decode characters of one stream by the kernel for the flat table of
+ * t, for a decoder which loads bytes into its bit buffer by itself,
+ * such as writeoutfile() of huffdec.c. Decoding starts with *count
+ * bits in *bits, the next bit at the top, and they are updated when
+ * it stops. Bits under *count may be loaded already, as by
+ * decode_interleaved(), and they are the same as the next bytes.
+ *
+ * Arguments:
+ *      dectable_pointer t - decoding table made by make_dectable().
+ *      unsigned char *in, long long insize - bytes to load next.
+ *      long long *used - set to the number of bytes loaded from in.
+ *      unsigned char *out, long long outsize - room for characters.
+ *
+ * Returns:
+ *      Number of characters decoded, 0 if t has no flat table, or if
+ *      less than 8 bytes are in in or a few characters of room in out.
+ */
+long long decode_run(dectable_pointer t, unsigned long long *bits, int *count,
+                     unsigned char *in, long long insize, long long *used,
+                     unsigned char *out, long long outsize)
+{
+  *used = 0;
+  switch (t->fastbits) {
+  case 8: return decode_chars(t->fast, bits, count, in, insize, used, out, outsize, 8);
+  case 11: return decode_chars(t->fast, bits, count, in, insize, used, out, outsize, 11);
+  case 15: return decode_chars(t->fast, bits, count, in, insize, used, out, outsize, 15);
+  }
+  return 0;
+}
+
+/*
+ * function decode_bits
+ *
+ * Decode outsize characters from codes packed by pack_codes() in
+ * insize bytes of in, as one stream with no stream size. Unlike
+ * decode_streams(), bytes after in are not read: 8 bytes are loaded
+ * at once only while they are in in, and the last bytes are loaded
+ * one by one, with bit 0 after the end. For messages encoded by a
+ * dictionary, which may be anywhere in memory of the caller.
+ *
+ * Returns:
+ *      1 if decoded, 0 if codes run over the end of in.
+ */
+int decode_bits(dectable_pointer t, unsigned char *in, int insize, unsigned char *out, int outsize)
+{
+  unsigned long long bits = 0;
+  unsigned char *p = in, *end = in + insize;
+  dentry_pointer table = t->entry, e;
+  int i, count = 0;
+
+  for (i=0; i<outsize; i++) {
+    if (end - p >= 8) {  // refill without branch, as decode_interleaved()
+      bits |= load_bits(p) >> count;
+      p += (63 - count) >> 3;
+      count |= 56;
+    }
+    else {
+      if (count < 64) bits &= ~(~0ULL >> count);  // clear bits loaded beyond count
+      for (; count <= 56; p++, count += 8)
+        bits |= (unsigned long long)(p < end ? *p : 0) << (56 - count);
+    }
+    e = &table[bits >> (64-DEC_TABLE_BITS)];
+    while (e->bits != 0) {  // if the code is longer than the table
+      bits <<= e->len;
+      count -= e->len;
+      e = &table[e->next + (bits >> (64-e->bits))];
+    }
+    bits <<= e->len;
+    count -= e->len;
+    out[i] = e->c;
   }
-  root = heap_remove(h);  // remainded node is root node of whole hufftree
-  free_heap(h);  // destroy heap
+  return 8 * (p - in) - count <= 8LL * insize;  // bits used
 }
@@ -13,12 +13,188 @@
 #define DEF_BINFILE "huffman.bin"
 #define DEF_FRQFILE "huffman.frq"
 
-/* must include heap.h because make_huffcode takes tnode_pointer. */
-#include "heap.h"
+#define MAX_CODELEN 32     // Maximum code length, bits of huffcode.
+#define MIN_MAXBITS 8      // Smallest code length limit, 256 characters need 8 bits.
+#define LENFILE_MAXBITS 15 // Maximum code length in code length file.
+#define LENFILE_MAGIC "HUFL"  // First 4 bytes of code length file.
+#define LENGTHS_MAXSIZE (32+128)  // bitmap and lengths saved by put_lengths()
+#define LENFILE_MAXSIZE (4+1+8+LENGTHS_MAXSIZE)  // magic, size, bitmap, lengths
+#define STREAM_MAGIC "HUFS"  // First 4 bytes of stream.
+#define CONTAINER_MAGIC "HUFC"  // First 4 bytes of container file.
+#define CONTAINER_VERSION 1     // Version of container file structure.
+#define CONTAINER_MAXSIZE (4+1+8+LENGTHS_MAXSIZE+1+OPTIONS_MAXSIZE)  // header of container file
+#define BLOCKHEAD_SIZE 9     // kind, characters and size of a block in stream
+#define COUNT_CHUNK (1 << 20)  // Bytes read at once to count frequency.
+#define COUNT_TABLES 8         // Tables count_bytes() counts to in turn.
+#define OPTIONS_MAXSIZE 32 // Maximum size of options.
+#define MAX_STREAMS 8      // Maximum number of interleaved streams.
+#define MIN_STREAMS_SIZE 4096  // Smaller files are encoded as one stream, not blocked.
+#define DEF_BLOCKSIZE (1 << 20)  // Default characters in one block.
+#define MIN_BLOCKSIZE (1 << 12)  // Minimum characters in one block.
+#define MAX_BLOCKSIZE (1 << 26)  // Maximum characters in one block.
+/* maximum size of a block of insize characters encoded by encode_streams() */
+#define STREAMS_BOUND(insize) (4*(insize) + 5*MAX_STREAMS + PACK_SLACK)
+#define DEC_TABLE_BITS 11  // Number of bits looked up at once when decoding.
+#define DEC_FAST_MAXBITS 15  // Longest code decoded by the flat table of make_dectable().
+#define DEC_FAST_MINCHARS(bits) (2LL << (bits))  // Characters worth making flat table of bits.
+#define PACK_SLACK 8       // Room pack_codes() needs at the end of output buffer.
+#define PACK_AUTO 0        // Paths of pack_codes(), by packpath: chosen by the CPU,
+#define PACK_SCALAR 1      //   one code at a time,
+#define PACK_AVX2 2        //   8 codes merged at once by AVX2.
+/* 1 if PACK_AUTO chooses AVX2 when the CPU has it. 0, as gathers and
+   merging don't pay for themselves and AVX2 packs slower; see huffbench. */
+#define PACK_AUTO_AVX2 0
+#define MAX_TREENODES (2*256)  // Nodes of huffman tree of 256 characters.
+#define MAX_TABLES 8       // Maximum number of codes of table set, with -g.
+#define TABLE_ROUNDS 4     // Rounds make_tableset() refines the table set.
+#define BLOCK_CODED 0      // Kinds of blocks of blocked bin file, by block_kind():
+#define BLOCK_STORED 1     //   saved as it is,
+#define BLOCK_RUN 2        //   one character repeated, saved once.
+#define INDEX_KINDSHIFT 30 // Kind is saved in the top 2 bits of block index.
+#define VARSIZE_MAXSIZE 10 // Maximum bytes of a size saved by put_varsize().
+/* maximum size of insize characters encoded by dictionary, with their size */
+#define DICT_BOUND(insize) (VARSIZE_MAXSIZE + 2*(insize) + PACK_SLACK)
+
+/*
+ * tnode_pointer
+ *
+ * Huffman tree node, in the flat array tree which make_hufftree()
+ * fills. Contains one character c, and its frequency, and index of
+ * left and right node in tree, -1 if none. Only leaf node has
+ * appropriate character c, and leaf node has no left node.
+ */
+typedef struct tnode *tnode_pointer;
+typedef struct tnode {
+  unsigned char c;
+  long long frq;// frequency
+  int left, right;
+} tnode_struct;
+
+/*
+ * dentry_pointer
+ *
+ * One entry of the decoding table. The decoder peeks DEC_TABLE_BITS
+ * bits and looks up one entry. If bits is 0, the entry is a leaf:
+ * character c is decoded and len bits are consumed. Otherwise the code
+ * is longer than the table, so len bits are consumed and the next
+ * 'bits' bits are looked up in the sub table starting at next.
+ */
+typedef struct dentry *dentry_pointer;
+typedef struct dentry {
+  unsigned char c;     // decoded character
+  unsigned char len;   // number of bits to consume
+  unsigned char bits;  // bit width of the sub table, 0 for leaf entry
+  int next;            // offset of the sub table in the decoding table
+} dentry_struct;
+
+/*
+ * dectable_pointer
+ *
+ * Decoding table made by make_dectable(). Entries are reallocated
+ * only when the table grows, so one table can be made again and again
+ * for each block.
+ *
+ * If no code is longer than DEC_FAST_MAXBITS, the code is also put in
+ * the flat table fast of 2^fastbits entries, the character in the low
+ * byte and the code length in the high byte, so one lookup always
+ * decodes one character. Set generic to 1 before make_dectable() to
+ * decode by entry only, to compare the speed.
+ */
+typedef struct dectable *dectable_pointer;
+typedef struct dectable {
+  dentry_pointer entry;  // entries, the root table at 0
+  int size;    // number of entries
+  int alloc;   // number of allocated entries
+  int maxlen;  // longest code length
+  unsigned short *fast;  // flat table, or NULL
+  int fastbits;  // bit width of fast, 0 if not used
+  int fastalloc; // number of allocated entries of fast
+  int generic;   // 1 if fast is not made
+} dectable_struct;
+
+/*
+ * code_pointer
+ *
+ * Huffman code of each character. The code of the whole file is the
+ * global filecode, and blocks which have their own code have their own
+ * code_struct, so blocks can be coded at the same time.
+ */
+typedef struct code *code_pointer;
+typedef struct code {
+  int bitlength[256];  // code length, 0 if the character doesn't appear
+  int huffcode[256];   // huffman code, the last bit at bit 0
+} code_struct;
+
+/*
+ * options_pointer
+ *
+ * Options saved with the code by put_options().
+ */
+typedef struct options *options_pointer;
+typedef struct options {
+  int maxbits;      // maximum code length, 0 if not limited
+  int nstreams;     // number of interleaved streams
+  int blocksize;    // characters in one block, 0 if not blocked
+  int blocktables;  // 1 if each block has its own code
+  int ntables;      // number of codes blocks choose from, 0 if no table set
+  int dictionary;   // 1 if the code is a dictionary for many inputs
+  long long size;   // original size, 0 if not saved
+} options_struct;
+
+/*
+ * packer_pointer
+ *
+ * State of pack_codes(). Bits packed but not written yet, the first
+ * bit at the top of bits. Each encoder thread has its own packer.
+ */
+typedef struct packer *packer_pointer;
+typedef struct packer {
+  unsigned long long bits;
+  int count;  // number of bits in bits
+} packer_struct;
 
 /* Functions huff.c offers */
+extern int put_options(options_pointer o, unsigned char *opt);
+extern int get_options(unsigned char *opt, int size, options_pointer o);
+extern int make_options(unsigned char *opt);
+extern void read_options(unsigned char *opt, int size);
+extern void count_bytes(unsigned char *in, int size, long long *counts);
+extern void count_frq();
+extern int block_kind(long long *counts, long long size, long long bits);
+extern void make_tableset();
+extern int put_tableset(unsigned char *out);
+extern int get_tableset(unsigned char *in, int size);
 extern void make_frqfile();
 extern void read_frqfile();
-extern void make_huffcode(tnode_pointer tn);
+extern void make_lenfile();
+extern int put_lenfile(code_pointer c, long long size, unsigned char *out);
+extern int get_lenfile(unsigned char *in, int len, code_pointer c, long long *size);
+extern int read_lenfile();
+extern int put_container(unsigned char *header);
+extern int read_container();
+extern int put_lengths(code_pointer c, unsigned char *out);
+extern int get_lengths(unsigned char *in, int size, code_pointer c);
+extern int put_varsize(long long size, unsigned char *out);
+extern int get_varsize(unsigned char *in, int len, long long *size);
+extern void make_canonical(code_pointer c);
+extern void make_huffcode(int tn);
 extern void make_hufftree();
+extern void make_lengths(long long *counts, int n, int *len, long long *work);
+extern void make_blockcode(long long *counts, code_pointer c, int limit);
+extern long long code_bits(long long *counts, code_pointer c);
+extern void make_dectable(dectable_pointer t, code_pointer c, long long chars);
+extern void free_dectable(dectable_pointer t);
+extern int pack_path();
+extern int pack_codes(packer_pointer pk, code_pointer c, unsigned char *in, int insize, unsigned char *out, int *outsize, int outcap);
+extern int flush_codes(packer_pointer pk, unsigned char *out);
+extern int encode_streams(code_pointer c, int nstreams, unsigned char *in, int insize, unsigned char *out);
+extern int check_streams(unsigned char *in, int size, int nstreams);
+extern int decode_streams(dectable_pointer t, int nstreams, unsigned char *in, unsigned char *out, int outsize);
+extern long long decode_run(dectable_pointer t, unsigned long long *bits, int *count,
+                            unsigned char *in, long long insize, long long *used,
+                            unsigned char *out, long long outsize);
+extern int decode_bits(dectable_pointer t, unsigned char *in, int insize, unsigned char *out, int outsize);
+extern unsigned char *map_infile(char *filename, long long *size);
+extern unsigned char *map_outfile(char *filename, long long size);
+extern void unmap_file(unsigned char *p, long long size);
 extern void file_error(char *filename);
@@ -0,0 +1,810 @@
+/*
+ * huffbench.c
+ *
+ * Benchmark utility for huffman coding.
+ *
+ * Makes test data in memory, makes huffman code for it and measures
+ * how fast each step runs. Files are not used, so only the speed of
+ * coding itself is measured.
+ *
+ * Usage:
+ *   huffbench [-p path] [size_in_mega_bytes]
+ *   huffbench -s [-z sizes] [-n nstreams] [-p path] [-f file]...
+ *
+ * Default size = 16 Mega Bytes
+ *
+ * Without -s, the former and the current way of each step are compared
+ * on text, and checked to give the same result. pack_codes() is
+ * measured by its scalar path and by AVX2 if the CPU has it.
+ *
+ * -s: suite mode. Each corpus of each size is measured, and one line of
+ *   tab separated values is printed for it, after a header line, so
+ *   results of two versions can be compared by diff or a script:
+ *      corpus      name of the corpus
+ *      size        bytes of the corpus
+ *      ratio       encoded size / size, with code lengths of blocks
+ *      count_MBps  count_bytes() speed
+ *      code_us     make_blockcode() time for one block of the corpus
+ *      table_us    make_dectable() time for the code of one block
+ *      encode_MBps encode_streams() speed
+ *      decode_MBps decode_streams() speed
+ *      generic_MBps decode_streams() speed by the generic table loop,
+ *                  not by the kernel for the longest code length
+ *   Corpora are text, binary (small 32 bit numbers), skewed (each byte
+ *   half as often as the one before), uniform (random bytes) and single
+ *   (one repeated byte), made with fixed seeds.
+ * -z sizes: comma separated sizes of corpora, with k, m or g suffix,
+ *   1k to 1g. Default 1k,64k,1m,16m.
+ * -n nstreams: interleaved streams of each block, 1, 2, 4 or 8.
+ * -f file: add the file as a corpus, with its own size only.
+ * -p path: path of pack_codes() for encode_MBps and the other steps,
+ *   auto (default, as pack_path() chooses), scalar or avx2.
+ *
+ * Each time is the best of BENCH_REPEAT runs, and each run repeats the
+ * step until it takes MIN_BENCH_TIME, so small sizes are timed right.
+ *
+ * You can simply type "make bench".
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "hufflib.h"
+
+#define DEF_BENCHSIZE 16  // Default size of test data in Mega Bytes.
+#define BENCH_REPEAT 5    // Each benchmark runs this times, and best is taken.
+#define CODE_BLOCKSIZE 4096  // Characters in one block for bench_codes().
+#define MIN_BENCH_TIME 0.02  // Seconds one run of the suite takes at least.
+#define MAX_SUITESIZE (1 << 30)  // Largest corpus of the suite.
+#define MAX_CORPORA 16    // Maximum number of corpora of the suite.
+#define FEED_CHUNK 1500   // Bytes pushed to huff_feed() at once, as a network packet.
+
+extern long long frq[256], originalsize;
+extern int nstreams, maxbits, tmplen, tmpcode;
+extern code_struct filecode;
+extern dectable_struct dectable;
+extern int root;
+extern int packpath;
+
+/*
+ * function now
+ *
+ * Returns:
+ *      Current time in seconds.
+ */
+double now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * function make_text
+ *
+ * Fill data with random letters and spaces, as often as they appear
+ * in English text, so short and long codes are mixed like in text.
+ * Random numbers are made by a simple linear congruential generator
+ * with fixed seed, so every run uses the same data.
+ */
+void make_text(unsigned char *data, int size)
+{
+  static char letters[] = " etaoinshrdlcumwfgypbvkjxqz";
+  static int weights[] = { 180, 102, 75, 67, 62, 57, 55, 52, 51, 49, 35,
+                           33, 23, 23, 20, 20, 18, 16, 16, 16, 12, 8, 6,
+                           1, 1, 1, 1 };  // per 1000 characters
+  unsigned int seed = 2003;
+  int i, k, r;
+  for (i=0; i<size; i++) {
+    seed = seed * 1103515245 + 12345;
+    r = (seed >> 16) % 1000;
+    for (k=0; r >= weights[k] && k < 26; k++) r -= weights[k];
+    data[i] = letters[k];
+  }
+}
+
+/*
+ * function make_uniform
+ *
+ * Fill data with uniform random bytes, by the same generator as
+ * make_text(), so all 256 characters appear.
+ */
+void make_uniform(unsigned char *data, int size)
+{
+  unsigned int seed = 2003;
+  int i;
+  for (i=0; i<size; i++) {
+    seed = seed * 1103515245 + 12345;
+    data[i] = seed >> 24;
+  }
+}
+
+/*
+ * function count_simple
+ *
+ * The former loop of make_frqfile(), which counts to one table.
+ * Kept to compare with count_bytes().
+ */
+void count_simple(unsigned char *in, int size, long long *counts)
+{
+  int i;
+  for (i=0; i<size; i++) counts[(int)in[i]]++;
+}
+
+/*
+ * function bench_count
+ *
+ * Run count function BENCH_REPEAT times and print the best speed.
+ */
+void bench_count(char *name, void (*count)(unsigned char *, int, long long *),
+                 unsigned char *in, int size, long long *counts)
+{
+  int i;
+  double start, best = 0;
+  for (i=0; i<BENCH_REPEAT; i++) {
+    memset(counts, 0, 256 * sizeof(long long));
+    start = now();
+    count(in, size, counts);
+    start = now() - start;
+    if (i == 0 || start < best) best = start;
+  }
+  printf("%-24s %8.1f MB/s\n", name, size / best / 1e6);
+}
+
+/*
+ * function bench_counts
+ *
+ * Benchmark the former counting loop and count_bytes() on uniform
+ * random bytes, text and one repeated byte, and check that both count
+ * the same.
+ *
+ * Returns:
+ *      0 if counts are the same, 1 if not.
+ */
+int bench_counts(unsigned char *text, unsigned char *tmp, int size)
+{
+  static char *names[] = { "uniform", "text", "single" };
+  long long counts1[256], counts2[256];
+  int k;
+  unsigned char *in;
+  char name[32];
+
+  for (k=0; k<3; k++) {
+    if (k == 0) {  // uniform random bytes
+      make_uniform(tmp, size);
+      in = tmp;
+    }
+    else if (k == 1) in = text;
+    else {  // one repeated byte
+      memset(tmp, 'a', size);
+      in = tmp;
+    }
+    sprintf(name, "count simple %s", names[k]);
+    bench_count(name, count_simple, in, size, counts1);
+    sprintf(name, "count_bytes %s", names[k]);
+    bench_count(name, count_bytes, in, size, counts2);
+    if (memcmp(counts1, counts2, sizeof(counts1)) != 0) {
+      fprintf(stderr, "Counts differ!\n");
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/*
+ * function bench_codes
+ *
+ * Count each block of CODE_BLOCKSIZE characters of in, and print how
+ * many codes per second make_hufftree() makes with its heap and tree,
+ * and make_blockcode() makes with make_lengths(). Checks that both
+ * codes take the same bits, as both are optimal. frq and filecode are
+ * cleared at the end.
+ *
+ * Returns:
+ *      0 if bits are the same, 1 if not.
+ */
+int bench_codes(char *name, unsigned char *in, int size)
+{
+  int nblocks = size / CODE_BLOCKSIZE, b, k, fail = 0;
+  long long *counts = calloc(nblocks, 256 * sizeof(long long));
+  code_struct c;
+  double start, best1 = 0, best2 = 0;
+
+  for (b=0; b<nblocks; b++)
+    count_bytes(in + b*CODE_BLOCKSIZE, CODE_BLOCKSIZE, counts + 256*b);
+  maxbits = 0;
+  for (k=0; k<BENCH_REPEAT; k++) {
+    start = now();
+    for (b=0; b<nblocks; b++) {  // tree by heap
+      memcpy(frq, counts + 256*b, sizeof(frq));
+      make_hufftree();
+      make_huffcode(root);
+    }
+    start = now() - start;
+    if (k == 0 || start < best1) best1 = start;
+    start = now();
+    for (b=0; b<nblocks; b++)  // lengths in place
+      make_blockcode(counts + 256*b, &c, MAX_CODELEN);
+    start = now() - start;
+    if (k == 0 || start < best2) best2 = start;
+  }
+  for (b=0; b<nblocks; b++) {
+    memset(&filecode, 0, sizeof(filecode));
+    memcpy(frq, counts + 256*b, sizeof(frq));
+    make_hufftree();
+    make_huffcode(root);
+    make_blockcode(counts + 256*b, &c, MAX_CODELEN);
+    if (code_bits(counts + 256*b, &filecode) != code_bits(counts + 256*b, &c)) fail = 1;
+  }
+  printf("code by heap tree %-7s %8.0f codes/s\n", name, nblocks / best1);
+  printf("code by lengths %-9s %8.0f codes/s\n", name, nblocks / best2);
+  memset(frq, 0, sizeof(frq));
+  memset(&filecode, 0, sizeof(filecode));
+  free(counts);
+  if (fail) fprintf(stderr, "Code bits differ!\n");
+  return fail;
+}
+
+/*
+ * function pack_bitwise
+ *
+ * The former loop of writebinfile(), which appends bits one by one.
+ * Kept to compare with pack_codes().
+ *
+ * Returns:
+ *      Number of bytes written to out.
+ */
+int pack_bitwise(unsigned char *in, int insize, unsigned char *out)
+{
+  int *bitlength = filecode.bitlength, *huffcode = filecode.huffcode;
+  unsigned char tmp=0;
+  int i, j, tmpsaved=0, writesize=0;
+  for (i=0; i<insize; i++) {   // for each read byte
+    for (j=bitlength[(int)in[i]]-1; j>=0; j--) {  // for each bits
+      tmpsaved++;
+      tmp = (tmp << 1) | ((huffcode[(int)in[i]] >> j) & 1);
+      if (tmpsaved == 8) {
+        out[writesize++] = tmp;
+        tmp = 0;
+        tmpsaved = 0;
+      }
+    }
+  }
+  if (tmpsaved != 0) out[writesize++] = tmp << (8-tmpsaved);
+  return writesize;
+}
+
+/*
+ * function pack_words
+ *
+ * Encode with pack_codes(), the way writebinfile() does.
+ *
+ * Returns:
+ *      Number of bytes written to out.
+ */
+int pack_words(unsigned char *in, int insize, unsigned char *out)
+{
+  packer_struct pk = { 0, 0 };
+  int writesize = 0;
+  pack_codes(&pk, &filecode, in, insize, out, &writesize, 4*insize+PACK_SLACK);
+  writesize += flush_codes(&pk, out+writesize);
+  return writesize;
+}
+
+/*
+ * function bench_encode
+ *
+ * Run pack function BENCH_REPEAT times and print the best speed.
+ *
+ * Returns:
+ *      Number of bytes written to out.
+ */
+int bench_encode(char *name, int (*pack)(unsigned char *, int, unsigned char *),
+                 unsigned char *in, int insize, unsigned char *out)
+{
+  int i, outsize = 0;
+  double start, best = 0;
+  for (i=0; i<BENCH_REPEAT; i++) {
+    start = now();
+    outsize = pack(in, insize, out);
+    start = now() - start;
+    if (i == 0 || start < best) best = start;
+  }
+  printf("%-24s %8.1f MB/s\n", name, insize / best / 1e6);
+  return outsize;
+}
+
+/*
+ * function bench_packs
+ *
+ * Benchmark the bit by bit encoder and pack_codes() by filecode, whose
+ * codes are up to maxlen bits long, by the scalar path and by AVX2 if
+ * the CPU has it, and check that all give the same output.
+ *
+ * Returns:
+ *      0 if outputs are the same, 1 if not.
+ */
+int bench_packs(int maxlen, unsigned char *in, int insize, unsigned char *out1, unsigned char *out2)
+{
+  int size1, size2, path = packpath, fail = 0;
+  printf("codes up to %d bits\n", maxlen);
+  size1 = bench_encode("encode bit by bit", pack_bitwise, in, insize, out1);
+  packpath = PACK_SCALAR;
+  size2 = bench_encode("encode word at a time", pack_words, in, insize, out2);
+  if (size1 != size2 || memcmp(out1, out2, size1) != 0) fail = 1;
+  packpath = PACK_AVX2;
+  if (pack_path() == PACK_AVX2) {
+    size2 = bench_encode("encode 8 codes by AVX2", pack_words, in, insize, out2);
+    if (size1 != size2 || memcmp(out1, out2, size1) != 0) fail = 1;
+  }
+  packpath = path;
+  if (fail) {
+    fprintf(stderr, "Encoded outputs differ!\n");
+    return 1;
+  }
+  printf("%d bytes encoded(%3.1f%%)\n", size2, (double)size2/insize*100);
+  return 0;
+}
+
+/*
+ * function bench_streams
+ *
+ * Encode data block by block into n interleaved streams, and print the
+ * best speed of decoding all blocks by decode_streams(), by the kernel
+ * for the longest code length and by the generic table loop. Checks
+ * that decoded data is the same as data.
+ *
+ * Returns:
+ *      0 if decoded data is the same, 1 if not.
+ */
+int bench_streams(int n, unsigned char *data, int size, unsigned char *enc, unsigned char *dec)
+{
+  int i, j, g, encsize = 0, blocks = 0;
+  int *offset = malloc((size / DEF_BLOCKSIZE + 2) * sizeof(int));
+  double start, best = 0;
+  char name[32];
+
+  nstreams = n;
+  for (i=0; i<size; i+=DEF_BLOCKSIZE) {  // encode
+    offset[blocks++] = encsize;
+    encsize += encode_streams(&filecode, nstreams, data+i, (size-i < DEF_BLOCKSIZE ? size-i : DEF_BLOCKSIZE), enc+encsize);
+  }
+  memset(enc+encsize, 0, 8);
+  for (g=0; g<2; g++) {  // kernel, then generic
+    dectable.generic = g;
+    make_dectable(&dectable, &filecode, size);
+    memset(dec, 0, size);
+    for (j=0; j<BENCH_REPEAT; j++) {
+      start = now();
+      for (i=0; i<blocks; i++)
+        decode_streams(&dectable, nstreams, enc+offset[i], dec+i*DEF_BLOCKSIZE,
+                       (size-i*DEF_BLOCKSIZE < DEF_BLOCKSIZE ? size-i*DEF_BLOCKSIZE : DEF_BLOCKSIZE));
+      start = now() - start;
+      if (j == 0 || start < best) best = start;
+    }
+    sprintf(name, "decode %d stream%s%s", n, n > 1 ? "s" : "", g ? " generic" : "");
+    printf("%-24s %8.1f MB/s\n", name, size / best / 1e6);
+    if (memcmp(data, dec, size) != 0) {
+      fprintf(stderr, "Decoded data differs!\n");
+      free(offset);
+      return 1;
+    }
+  }
+  dectable.generic = 0;
+  free(offset);
+  return 0;
+}
+
+/*
+ * function bench_feed
+ *
+ * Encode data to a stream of n interleaved streams by huff_encode(),
+ * and print the best speed of decoding it whole by huff_decode(), and
+ * pushed in pieces of FEED_CHUNK bytes to huff_feed(). Checks that both
+ * decode data, and that huff_feed() takes a stream with no options and
+ * no block, as huff_decode() does, and doesn't loop on its header.
+ *
+ * Returns:
+ *      0 if decoded data is the same, 1 if not.
+ */
+int bench_feed(int n, unsigned char *data, int size, unsigned char *enc, unsigned char *dec)
+{
+  huff_pointer hp = huff_new(0, n, 0);
+  huff_feed_pointer f;
+  unsigned char empty[5 + BLOCKHEAD_SIZE + 8] = STREAM_MAGIC;  // options of 0 bytes
+  long long encsize, i, o, used, got;
+  double start, best1 = 0, best2 = 0;
+  int j, fail = 0;
+  char name[32];
+
+  encsize = huff_encode(hp, data, size, enc, huff_bound(hp, size));
+  memset(enc+encsize, 0, 8);
+  for (j=0; j<BENCH_REPEAT; j++) {
+    memset(dec, 0, size);
+    start = now();
+    got = huff_decode(hp, enc, encsize, dec, size);
+    start = now() - start;
+    if (j == 0 || start < best1) best1 = start;
+    if (got != size || memcmp(data, dec, size) != 0) fail = 1;
+
+    memset(dec, 0, size);
+    start = now();
+    f = huff_feed_new(0, 0, 0, 0);
+    for (i=0, o=0; i<encsize; i+=used) {
+      got = huff_feed(f, enc+i, (encsize-i < FEED_CHUNK ? encsize-i : FEED_CHUNK), &used, dec+o, size-o);
+      if (got < 0) break;
+      o += got;
+    }
+    if (huff_feed_end(f, dec+o, size-o) != 0) fail = 1;
+    huff_feed_free(f);
+    start = now() - start;
+    if (j == 0 || start < best2) best2 = start;
+    if (o != size || memcmp(data, dec, size) != 0) fail = 1;
+  }
+  huff_put_end(empty + 5);
+  f = huff_feed_new(0, 0, 0, 0);
+  if (huff_decode(hp, empty, 5 + BLOCKHEAD_SIZE, dec, size) != 0 ||
+      huff_feed(f, empty, 5 + BLOCKHEAD_SIZE, &used, dec, size) != 0 || used != 5 + BLOCKHEAD_SIZE ||
+      huff_feed_end(f, dec, size) != 0)
+    fail = 1;
+  huff_feed_free(f);
+  sprintf(name, "huff_decode %d stream%s", n, n > 1 ? "s" : "");
+  printf("%-24s %8.1f MB/s\n", name, size / best1 / 1e6);
+  sprintf(name, "huff_feed %d stream%s", n, n > 1 ? "s" : "");
+  printf("%-24s %8.1f MB/s\n", name, size / best2 / 1e6);
+  huff_free(hp);
+  if (fail) fprintf(stderr, "Fed data differs!\n");
+  return fail;
+}
+
+/*
+ * function make_binary
+ *
+ * Fill data with 32 bit little endian numbers below 65536, most of
+ * them small, like tables of binary files. Upper bytes are mostly 0.
+ */
+void make_binary(unsigned char *data, int size)
+{
+  unsigned int seed = 2003, v = 0;
+  int i;
+  for (i=0; i<size; i++) {
+    if (i % 4 == 0) {
+      seed = seed * 1103515245 + 12345;
+      v = (seed >> 16) >> ((seed >> 8) & 15);  // small numbers more often
+    }
+    data[i] = (v >> (8 * (i % 4))) & 0xff;
+  }
+}
+
+/*
+ * function make_skewed
+ *
+ * Fill data with bytes 0, 1, 2, ..., each half as often as the one
+ * before, so codes get as long as the limit.
+ */
+void make_skewed(unsigned char *data, int size)
+{
+  unsigned int seed = 2003, r;
+  int i, k;
+  for (i=0; i<size; i++) {
+    seed = seed * 1103515245 + 12345;
+    r = seed >> 8;
+    for (k=0; k<24 && (r & 1) == 0; k++) r >>= 1;
+    data[i] = k;
+  }
+}
+
+/*
+ * function make_single
+ *
+ * Fill data with one repeated byte.
+ */
+void make_single(unsigned char *data, int size)
+{
+  memset(data, 'a', size);
+}
+
+/*
+ * Corpus and code the steps of bench_suite() work on.
+ */
+static unsigned char *sdata, *senc, *sdec;
+static int ssize, sblocks, *soffset;
+static long long scounts[256];
+static code_struct scode;
+static dectable_struct stable;
+
+/*
+ * Steps of bench_suite(), each run again and again by measure().
+ */
+static void step_count()
+{
+  memset(scounts, 0, sizeof(scounts));
+  count_bytes(sdata, ssize, scounts);
+}
+
+static void step_code()
+{
+  make_blockcode(scounts, &scode, LENFILE_MAXBITS);
+}
+
+static void step_table()
+{
+  make_dectable(&stable, &scode, ssize);
+}
+
+static void step_encode()
+{
+  int i, n;
+  for (i=0; i<sblocks; i++) {
+    n = (ssize - i*DEF_BLOCKSIZE < DEF_BLOCKSIZE ? ssize - i*DEF_BLOCKSIZE : DEF_BLOCKSIZE);
+    soffset[i+1] = soffset[i] + encode_streams(&scode, nstreams, sdata + i*DEF_BLOCKSIZE, n, senc + soffset[i]);
+  }
+}
+
+static void step_decode()
+{
+  int i, n;
+  for (i=0; i<sblocks; i++) {
+    n = (ssize - i*DEF_BLOCKSIZE < DEF_BLOCKSIZE ? ssize - i*DEF_BLOCKSIZE : DEF_BLOCKSIZE);
+    decode_streams(&stable, nstreams, senc + soffset[i], sdec + i*DEF_BLOCKSIZE, n);
+  }
+}
+
+/*
+ * function measure
+ *
+ * Run step until MIN_BENCH_TIME passes, BENCH_REPEAT times.
+ *
+ * Returns:
+ *      Best seconds one step took.
+ */
+double measure(void (*step)())
+{
+  double start, t, best = 0;
+  int i, k, n;
+  for (k=0; k<BENCH_REPEAT; k++) {
+    n = 0;
+    start = now();
+    do {
+      for (i=0; i<(n == 0 ? 1 : n); i++) step();
+      n = (n == 0 ? 1 : 2*n);
+      t = now() - start;
+    } while (t < MIN_BENCH_TIME);
+    t /= 2*n - 1;  // steps run are 1+1+2+4+...
+    if (k == 0 || t < best) best = t;
+  }
+  return best;
+}
+
+/*
+ * function parse_size
+ *
+ * Returns:
+ *      Size of string like "64k", or 0 if wrong.
+ */
+long long parse_size(char *str)
+{
+  char *end;
+  long long size = strtoll(str, &end, 10);
+  if (*end == 'k' || *end == 'K') size <<= 10;
+  else if (*end == 'm' || *end == 'M') size <<= 20;
+  else if (*end == 'g' || *end == 'G') size <<= 30;
+  else if (*end != '\0' && *end != ',') return 0;
+  return (size <= 0 || size > MAX_SUITESIZE ? 0 : size);
+}
+
+/*
+ * function bench_corpus
+ *
+ * Measure each step on sdata of ssize bytes, check decoded data, and
+ * print one line of the suite.
+ *
+ * Returns:
+ *      0 if decoded data is the same, 1 if not.
+ */
+int bench_corpus(char *name)
+{
+  double tcount, tcode, ttable, tencode, tdecode, tgeneric;
+
+  sblocks = (ssize + DEF_BLOCKSIZE - 1) / DEF_BLOCKSIZE;
+  tcount = measure(step_count);
+  tcode = measure(step_code);
+  ttable = measure(step_table);
+  tencode = measure(step_encode);
+  memset(senc + soffset[sblocks], 0, 8);
+  tdecode = measure(step_decode);
+  if (memcmp(sdata, sdec, ssize) != 0) {
+    fprintf(stderr, "Decoded data differs: %s\n", name);
+    return 1;
+  }
+  stable.generic = 1;
+  make_dectable(&stable, &scode, ssize);
+  memset(sdec, 0, ssize);
+  tgeneric = measure(step_decode);
+  stable.generic = 0;
+  if (memcmp(sdata, sdec, ssize) != 0) {
+    fprintf(stderr, "Decoded data differs: %s generic\n", name);
+    return 1;
+  }
+  printf("%s\t%d\t%.4f\t%.1f\t%.2f\t%.2f\t%.1f\t%.1f\t%.1f\n", name, ssize,
+         (double)(soffset[sblocks] + sblocks * LENGTHS_MAXSIZE) / ssize,
+         ssize / tcount / 1e6, tcode * 1e6, ttable * 1e6, ssize / tencode / 1e6, ssize / tdecode / 1e6,
+         ssize / tgeneric / 1e6);
+  fflush(stdout);
+  return 0;
+}
+
+/*
+ * function bench_suite
+ *
+ * Run the suite of -s, each corpus of each size in sizes, then each
+ * file, and print tab separated lines after a header line.
+ *
+ * Returns:
+ *      0 if all decoded data is the same, 1 if not or out of memory.
+ */
+int bench_suite(char *sizes, char **files, int nfiles)
+{
+  static char *names[] = { "text", "binary", "skewed", "uniform", "single" };
+  static void (*makes[])(unsigned char *, int) = { make_text, make_binary, make_skewed,
+                                                    make_uniform, make_single };
+  long long size[MAX_CORPORA];
+  int i, k, n = 0, max = 0, fail = 0;
+  char *p;
+  FILE *f;
+
+  for (p=sizes; n < MAX_CORPORA; p++) {  // sizes
+    size[n] = parse_size(p);
+    if (size[n] == 0) {
+      fprintf(stderr, "sizes must be like 1k,64k,1m, up to 1g\n");
+      return 1;
+    }
+    if (size[n] > max) max = size[n];
+    n++;
+    p = strchr(p, ',');
+    if (p == NULL) break;
+  }
+  for (i=0; i<nfiles; i++) {  // sizes of files
+    f = fopen(files[i], "rb");
+    if (f == NULL) {
+      file_error(files[i]);
+      return 1;
+    }
+    fseek(f, 0, SEEK_END);
+    if (ftell(f) > max) max = (ftell(f) > MAX_SUITESIZE ? MAX_SUITESIZE : ftell(f));
+    fclose(f);
+  }
+  sdata = malloc(max);
+  senc = malloc(2*(long long)max + ((max + DEF_BLOCKSIZE - 1) / DEF_BLOCKSIZE) * STREAMS_BOUND(0));
+  sdec = malloc(max);
+  soffset = malloc(((max + DEF_BLOCKSIZE - 1) / DEF_BLOCKSIZE + 1) * sizeof(int));
+  if (sdata == NULL || senc == NULL || sdec == NULL || soffset == NULL) {
+    fprintf(stderr, "Out of memory!\n");
+    return 1;
+  }
+  soffset[0] = 0;
+
+  printf("corpus\tsize\tratio\tcount_MBps\tcode_us\ttable_us\tencode_MBps\tdecode_MBps\tgeneric_MBps\n");
+  for (k=0; k<5; k++) {
+    for (i=0; i<n; i++) {
+      ssize = size[i];
+      makes[k](sdata, ssize);
+      fail |= bench_corpus(names[k]);
+    }
+  }
+  for (i=0; i<nfiles; i++) {
+    f = fopen(files[i], "rb");
+    ssize = fread(sdata, 1, max, f);
+    fclose(f);
+    if (ssize > 0) fail |= bench_corpus(files[i]);
+  }
+  free(sdata);
+  free(senc);
+  free(sdec);
+  free(soffset);
+  free_dectable(&stable);
+  return fail;
+}
+
+/*
+ * main function
+ *
+ * Benchmarks the former counting loop and count_bytes(), making codes
+ * of small blocks by tree and by lengths, the former bit by bit
+ * encoder and pack_codes(), and checks that both make the same result.
+ * With -s, runs bench_suite() instead. Then benchmarks decoding of one and interleaved streams,
+ * and of streams of hufflib.c decoded whole and pushed in pieces, and
+ * encoding again by codes of skewed data, which are longer than 14 bits.
+ */
+int main(int argc, char *argv[])
+{
+  int size = DEF_BENCHSIZE, i, opt, suite = 0, maxlen = 0;
+  unsigned char *data, *out1, *out2;
+  char *sizes = "1k,64k,1m,16m", *files[MAX_CORPORA];
+  int nfiles = 0;
+
+  while ((opt = getopt(argc, argv, "sz:n:f:p:")) != -1) {
+    switch (opt) {
+    case 's':  // suite mode
+      suite = 1;
+      break;
+    case 'z':  // sizes of corpora
+      sizes = optarg;
+      break;
+    case 'n':  // number of interleaved streams
+      nstreams = atoi(optarg);
+      if (nstreams != 1 && nstreams != 2 && nstreams != 4 && nstreams != 8) {
+        fprintf(stderr, "nstreams must be 1, 2, 4 or 8\n");
+        return 1;
+      }
+      break;
+    case 'f':  // file as a corpus
+      if (nfiles < MAX_CORPORA) files[nfiles++] = optarg;
+      break;
+    case 'p':  // path of pack_codes()
+      if (strcmp(optarg, "auto") == 0) packpath = PACK_AUTO;
+      else if (strcmp(optarg, "scalar") == 0) packpath = PACK_SCALAR;
+      else if (strcmp(optarg, "avx2") == 0) packpath = PACK_AVX2;
+      else {
+        fprintf(stderr, "path must be auto, scalar or avx2\n");
+        return 1;
+      }
+      if (packpath == PACK_AVX2 && pack_path() != PACK_AVX2) {
+        fprintf(stderr, "This CPU has no AVX2\n");
+        return 1;
+      }
+      break;
+    default:
+      fprintf(stderr, "Usage: huffbench [-p path] [size_in_mega_bytes]\n"
+              "       huffbench -s [-z sizes] [-n nstreams] [-p path] [-f file]...\n");
+      return 1;
+    }
+  }
+  if (suite) return bench_suite(sizes, files, nfiles);
+  if (optind < argc) size = atoi(argv[optind]);
+  if (size <= 0) size = DEF_BENCHSIZE;
+  size *= 1024 * 1024;
+  data = malloc(size);
+  out1 = malloc(4*size+PACK_SLACK);
+  out2 = malloc(4*size+PACK_SLACK);
+  if (data == NULL || out1 == NULL || out2 == NULL) {
+    fprintf(stderr, "Out of memory!\n");
+    return 1;
+  }
+
+  make_text(data, size);
+  printf("%d bytes of test data\n", size);
+  if (bench_counts(data, out1, size)) return 1;
+  make_uniform(out1, size);
+  if (bench_codes("text", data, size) || bench_codes("uniform", out1, size)) return 1;
+
+  for (i=0; i<size; i++) frq[data[i]]++;
+  originalsize = size;
+  make_hufftree();
+  make_huffcode(root);
+
+  for (i=0; i<256; i++)
+    if (filecode.bitlength[i] > maxlen) maxlen = filecode.bitlength[i];
+  if (bench_packs(maxlen, data, size, out1, out2)) return 1;
+
+  make_dectable(&dectable, &filecode, size);
+  if (bench_streams(1, data, size, out1, out2) || bench_streams(4, data, size, out1, out2) ||
+      bench_streams(8, data, size, out1, out2))
+    return 1;
+  if (bench_feed(1, data, size, out1, out2) || bench_feed(4, data, size, out1, out2)) return 1;
+
+  make_skewed(data, size);  // codes longer than 14 bits
+  memset(frq, 0, sizeof(frq));
+  memset(&filecode, 0, sizeof(filecode));
+  for (i=0; i<size; i++) frq[data[i]]++;
+  make_hufftree();
+  make_huffcode(root);
+  for (i=0, maxlen=0; i<256; i++)
+    if (filecode.bitlength[i] > maxlen) maxlen = filecode.bitlength[i];
+  if (bench_packs(maxlen, data, size, out1, out2)) return 1;
+  free(data);
+  free(out1);
+  free(out2);
+  return 0;
+}
@@ -4,7 +4,50 @@
  * Utility for encoding huffman code.
  *
  * Usage:
- * huffdec [output_file] [bin_file] [frq_file]
+ * huffdec [-mp] [-t nthreads] [-r offset[,length]] [-q nbuffers[,bufsize]]
+ *         [--stats[=stats_file]] [--generic] [output_file] [bin_file] [frq_file]
+ * huffdec -a [-t nthreads] [-f list_file] [bin_file]...
+ *
+ * -t nthreads: decode blocks of blocked bin file at the same time by
+ *   nthreads threads (1 to 64).
+ * -m: map bin_file and output_file to memory. Output file is made
+ *   with the original size, and characters are decoded right into it.
+ *   Files that can't be mapped, such as pipes, use fread and fwrite.
+ * -p: stream mode. Decode the stream which "huffenc -p" wrote, with
+ *   no frq_file. output_file and bin_file are "-" (standard output and
+ *   input) by default.
+ * -r offset[,length]: decode only length characters from offset of
+ *   the original file, or to the end if length is not given. Blocks of
+ *   blocked bin file and stream can be decoded independently, so only
+ *   blocks in the range are decoded, and "huffenc -b" sets how far
+ *   apart they are. Bin file of one stream is decoded from the start.
+ * -q nbuffers[,bufsize]: pipeline mode. A reader thread reads bin_file
+ *   ahead and a writer thread writes output_file behind, while blocks
+ *   are decoded, so I/O and decoding overlap. Each has a ring of
+ *   nthreads + nbuffers (1 to 64) buffers. Buffers hold one block, or
+ *   bufsize Kilo Bytes (4 to 65536, default 64) if bin file is not
+ *   blocked.
+ * --stats[=stats_file]: write wall clock and CPU time of each phase
+ *   (histogram, tree, code, decode and io), bytes in and out, the
+ *   longest code length, average bits of codes and entropy as one line
+ *   of JSON to stats_file, or to standard error. Frequencies are not
+ *   known to huffdec, so decoded characters are counted again, as
+ *   histogram. Blocks decoded on threads are timed as a whole, so
+ *   making codes of blocks with their own codes is timed as decode.
+ * --generic: decode every code by the generic loop of the decoding
+ *   table with sub tables, not by the kernel for the longest code
+ *   length, to compare their speed. Output is the same.
+ * -a: batch mode. Decode each bin_file, written by "huffenc -a", to
+ *   its name without ".huf". Files are shared by a pool of nthreads
+ *   threads, and totals of all files are printed at the end. A file
+ *   that can't be decoded is reported and skipped.
+ * -f list_file: with -a, also decode the files named in list_file, one
+ *   on each line. "-" reads the names from standard input.
+ *
+ * frq_file may be frequency file or code length file, huffdec finds
+ * out which one it is. It may be a dictionary, written by "huffenc -w",
+ * for bin_file encoded by "huffenc -d" with it. If bin_file is container file written by
+ * "huffenc -k", the code is read from it and frq_file is not used.
  *
  * Default output_file = "huffman.out"
  * Default bin_file = "huffman.bin"
@@ -16,66 +59,782 @@
  * Date: 2003/11/22
  */
 #include <stdio.h>
-#include "huff.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <getopt.h>
+#include "hufflib.h"
+#include "pool.h"
+#include "batch.h"
 
 extern char outfilename[256], binfilename[256], frqfilename[256];
-extern int frq[256], bitlength[256], tmplen, tmpcode[9], originalsize;
+extern long long frq[256], originalsize, binoffset;
+extern int tmplen, tmpcode;
+extern code_struct filecode;
 extern unsigned char buf[BUFSIZ], wbuf[BUFSIZ];
-extern heap_pointer h;
-extern tnode_pointer root;
+extern int root;
+extern dectable_struct dectable;
+extern int nstreams, blocksize, nthreads, blocktables, usemmap, nbuffers, iosize;
+extern int ntables, dictionary;
+extern code_struct tablecode[MAX_TABLES];
+
+long long rangestart=0, rangesize=-1;  // characters to decode with -r, -1 for all
+stats_pointer stats=NULL;  // time and counters of decoding, with --stats
+FILE *statsf;              // file stats are written to
+ring_pointer inring=NULL, outring=NULL;  // buffers of reader and writer stages, with -q
+stage_pointer readstage, writestage;
+int inheld=0;  // 1 if a buffer of inring is taken by read_chunk()
+int generic=0;  // 1 to decode by the generic table loop, with --generic
+
+/*
+ * function start_pipeline
+ *
+ * With -q, start a reader stage which reads binf to buffers of insize
+ * bytes, by reader, or by chunks of insize if reader is NULL, and a
+ * writer stage which writes buffers of outsize bytes to outf. No stage
+ * is started for a mapped file, given as NULL. Each ring has nbuffers
+ * buffers more than threads, so the reader reads ahead and the writer
+ * writes behind while nthreads buffers are decoded.
+ */
+void start_pipeline(void (*reader)(void *arg), FILE *binf, int insize, FILE *outf, int outsize)
+{
+  if (nbuffers == 0) return;
+  if (binf != NULL) inring = ring_new(nthreads + nbuffers, insize);
+  if (outf != NULL) outring = ring_new(nthreads + nbuffers, outsize);
+  if ((binf != NULL && inring == NULL) || (outf != NULL && outring == NULL)) {
+    fprintf(stderr, "Out of memory!\n");
+    exit(1);
+  }
+  if (inring != NULL) readstage = (reader != NULL ? start_stage(reader, binf) : start_reader(inring, binf));
+  if (outring != NULL) writestage = start_writer(outring, outf);
+}
+
+/*
+ * function end_pipeline
+ *
+ * End the stages of start_pipeline(). The reader stops reading, and
+ * the writer ends after writing all filled buffers.
+ */
+void end_pipeline()
+{
+  if (inring != NULL) {
+    ring_drain(inring);
+    join_stage(readstage);
+    ring_free(inring);
+    inring = NULL;
+    inheld = 0;
+  }
+  if (outring != NULL) {
+    ring_close(outring);
+    join_stage(writestage);
+    ring_free(outring);
+    outring = NULL;
+  }
+}
+
+/*
+ * function read_chunk
+ *
+ * Point *in to the next chunk of bin file, in a buffer of the reader
+ * stage, or read to buf. The buffer before is released.
+ *
+ * Returns:
+ *      Bytes of the chunk, 0 at the end of file.
+ */
+int read_chunk(FILE *binf, unsigned char **in)
+{
+  int size;
+  if (inring == NULL) {
+    *in = buf;
+    return fread(buf, 1, BUFSIZ, binf);
+  }
+  if (inheld) ring_release(inring);
+  *in = ring_full(inring, &size);
+  inheld = (*in != NULL);
+  return (*in != NULL ? size : 0);
+}
+
+/*
+ * function write_range
+ *
+ * Write size characters of out, which are characters from done of the
+ * original file, to outf. Only characters in the range of -r are
+ * written, so out may be partly or not written. With -q, out is the
+ * next buffer of the writer stage, and is passed to it with only the
+ * characters in the range.
+ */
+void write_range(unsigned char *out, long long done, long long size, FILE *outf)
+{
+  long long start = (rangestart > done ? rangestart - done : 0);
+  long long end = (rangestart + rangesize < done + size ? rangestart + rangesize - done : size);
+  if (outring != NULL) {
+    if (start > 0 && start < end) memmove(out, out + start, end - start);
+    ring_fill(outring, (start < end ? end - start : 0));
+  }
+  else if (start < end) fwrite(out + start, 1, end - start, outf);
+}
 
 /*
  * function writeoutfile
  *
  * Write out file with huffman decoding.
  * Block read/write for faster file I/O.
+ *
+ * Bits are loaded into a 64 bit buffer, the next bit at the top. For
+ * each character the top DEC_TABLE_BITS bits are looked up in the
+ * decoding table, which gives the character and its code length at
+ * once. Only codes longer than DEC_TABLE_BITS follow links to sub
+ * tables. The bit buffer is refilled byte by byte when fewer bits than
+ * the longest code are left, so one character never needs a refill in
+ * the middle.
+ *
+ * If no code is longer than DEC_FAST_MAXBITS, decode_run() decodes
+ * characters by the kernel for the longest code length while 8 bytes
+ * are left in the buffer, with no sub table and no check for each
+ * character, and only the last bytes of the buffer are loaded one by
+ * one.
+ *
+ * With -m, a mapped bin file is loaded as one block and characters are
+ * put right into the mapped output file, so buf and wbuf are not used.
+ *
+ * Encoded data starts at binoffset, after the header of container file.
+ *
+ * With -r, decoding stops at the end of the range, and characters
+ * before the range are decoded but not written, as one stream has no
+ * point to start in the middle. Output is mapped only if the range
+ * starts at 0.
+ *
+ * With -q, chunks of iosize bytes are read by the reader stage and
+ * written by the writer stage, instead of buf and wbuf.
  */
 void writeoutfile()
 {
   FILE *binf;
-  FILE *outf;
-  unsigned char tmp=0;
-  int tmploaded=0, readsize=0, writesize=0, encodedsize, remainedsize=originalsize;
-  tnode_pointer tn;
+  FILE *outf = NULL;
+  unsigned long long bitbuf=0;  // loaded bits, the next bit at the top
+  unsigned char *in = buf, *out = wbuf, *binmap = NULL, *outmap = NULL;
+  long long readsize=0, loadsize, writesize=0, encodedsize, remainedsize=rangestart+rangesize;
+  long long outcap = BUFSIZ, done = 0, n, used;
+  int bitcount=0;
+  dentry_pointer table = dectable.entry, e;
 
-  outf = fopen(outfilename, "wb");
+  if (usemmap && rangestart == 0) outmap = map_outfile(outfilename, rangesize);
+  if (outmap != NULL) {
+    out = outmap;
+    outcap = rangesize;
+  }
+  else outf = fopen(outfilename, "wb");
   binf = fopen(binfilename, "rb");
   if (binf == NULL) {  // file not found error
     file_error(binfilename);
     exit(1);
   }
-  encodedsize = fread(buf, 1, BUFSIZ, binf);  // read one block
-  tmp=buf[readsize++];
+  stats_phase(stats, PHASE_IO);
+  if (usemmap) binmap = map_infile(binfilename, &loadsize);
+  if (binmap == NULL) fseek(binf, binoffset, SEEK_SET);
+  start_pipeline(NULL, (binmap == NULL ? binf : NULL), iosize, outf, iosize);
+  if (outring != NULL) {
+    out = ring_empty(outring);
+    outcap = iosize;
+  }
+  if (binmap != NULL) {
+    in = binmap;
+    encodedsize = loadsize;
+    readsize = binoffset;
+    fseek(binf, 0, SEEK_END);  // nothing more to read
+  }
+  else {
+    loadsize = read_chunk(binf, &in);  // read one block
+    encodedsize = binoffset + loadsize;
+  }
+  stats_phase(stats, PHASE_CODING);
   while (remainedsize > 0) {
-    tn = root;
-    while(tn->left != NULL) {  // if not leaf node
-      if ((tmp & (0x80 >> tmploaded))==0)  // read next bit
-        tn = tn->left;   // go to left child if bit is 0
-      else
-        tn = tn->right;  // go to right child if bit is 1
-      tmploaded++;
-      if (tmploaded==8) {  // if eight bit was read
-        tmploaded=0;
-        tmp=buf[readsize++];  // take new byte
-        if (readsize==BUFSIZ) {  // if nothing more read in buffer
-          encodedsize += fread(buf, 1, BUFSIZ, binf);  // load one block
-          readsize=0;
+    n = 0;
+    if (loadsize - readsize >= 8) {  // many characters by the kernel, if codes are short
+      n = decode_run(&dectable, &bitbuf, &bitcount, in + readsize, loadsize - readsize, &used,
+                     out + writesize, (outcap - writesize < remainedsize ? outcap - writesize : remainedsize));
+      readsize += used;
+    }
+    if (n == 0) {  // one character, by loading bytes one by one
+      if (bitcount < dectable.maxlen) {  // if the longest code may not be loaded
+        while (bitcount <= 56) {  // load bytes until the bit buffer is full
+          if (readsize == loadsize) {  // if nothing more read in buffer
+            stats_phase(stats, PHASE_IO);
+            loadsize = read_chunk(binf, &in);  // load one block
+            stats_phase(stats, PHASE_CODING);
+            encodedsize += loadsize;
+            readsize = 0;
+            if (loadsize == 0) {  // end of file, pad with bit 0
+              bitcount = 64;
+              break;
+            }
+          }
+          bitbuf |= (unsigned long long)in[readsize++] << (56-bitcount);
+          bitcount += 8;
         }
       }
+      e = &table[bitbuf >> (64-DEC_TABLE_BITS)];  // look up the first bits
+      while (e->bits != 0) {  // if the code is longer than the table
+        bitbuf <<= e->len;
+        bitcount -= e->len;
+        e = &table[e->next + (bitbuf >> (64-e->bits))];  // look up the sub table
+      }
+      bitbuf <<= e->len;  // consume the code
+      bitcount -= e->len;
+      out[writesize]=e->c;  // put the character
+      n = 1;
     }
-    // if leaf node
-    wbuf[writesize++]=tn->c;  // put the character
-    if (writesize==BUFSIZ) {  // if buffer full
-      fwrite(wbuf, 1, BUFSIZ, outf);  // write out one block
+    writesize += n;
+    if (writesize==outcap && outmap == NULL) {  // if buffer full
+      if (stats != NULL) {
+        stats_phase(stats, PHASE_HISTOGRAM);
+        stats_count(stats, out, outcap, &filecode);
+        stats_phase(stats, PHASE_IO);
+      }
+      write_range(out, done, outcap, outf);  // write out one block
+      if (outring != NULL) out = ring_empty(outring);
+      stats_phase(stats, PHASE_CODING);
+      done += outcap;
       writesize=0;
     }
     // decrease remained byte size
-    remainedsize--;
+    remainedsize -= n;
+  }
+  stats_phase(stats, PHASE_HISTOGRAM);
+  stats_count(stats, out, writesize, &filecode);
+  stats_phase(stats, PHASE_IO);
+  if (outmap != NULL) unmap_file(outmap, rangesize);
+  else write_range(out, done, writesize, outf);  // file write for remained bytes
+  end_pipeline();
+  if (outf != NULL) fclose(outf);
+  if (binmap != NULL) unmap_file(binmap, encodedsize);
+  fclose(binf);
+  if (stats != NULL) {
+    stats->bytesin = encodedsize;
+    stats->bytesout = rangesize;
+  }
+  printf("%lld bytes(%3.1f) -> %lld bytes\n", encodedsize, (double)encodedsize/originalsize*100, rangesize);
+}
+
+/*
+ * Blocks decoded at once by writeoutfile_blocks(), one for each thread.
+ * Blocks point into inbuf and outbuf, or into mapped files with -m.
+ */
+unsigned char *inblock[MAX_THREADS], *outblock[MAX_THREADS];
+unsigned char *inbuf[MAX_THREADS], *outbuf[MAX_THREADS];
+int outsize[MAX_THREADS], lensize[MAX_THREADS];
+code_struct blockcode[MAX_THREADS];  // code of each block, if blocks have
+dectable_struct blocktable[MAX_THREADS];  // their own codes
+int insel[MAX_THREADS];  // table of each block, with table set
+int inkind[MAX_THREADS];  // kind of each block, from block index
+int inbroken[MAX_THREADS];  // 1 if codes of the block run over its streams
+dectable_struct settable[MAX_TABLES];  // decoding tables of table set
+
+/*
+ * function decode_job
+ *
+ * Decode block i of the blocks read at once. Run by run_jobs().
+ *
+ * If each block has its own code, the code lengths were read before
+ * the block, so its canonical code and decoding table are made first.
+ * With table set, decoding tables were made before any block, and the
+ * block is decoded by the one of its table.
+ *
+ * A stored block is copied, and a block of one character is filled
+ * with it, with no decoding. inbroken[i] is set if decoding finds the
+ * block broken.
+ */
+void decode_job(void *arg, int i)
+{
+  inbroken[i] = 0;
+  if (inkind[i] == BLOCK_STORED)
+    memcpy(outblock[i], inblock[i], outsize[i]);
+  else if (inkind[i] == BLOCK_RUN)
+    memset(outblock[i], inblock[i][0], outsize[i]);
+  else if (blocktables) {
+    make_canonical(&blockcode[i]);
+    blocktable[i].generic = generic;
+    make_dectable(&blocktable[i], &blockcode[i], outsize[i]);
+    inbroken[i] = !decode_streams(&blocktable[i], nstreams, inblock[i]+lensize[i], outblock[i], outsize[i]);
+  }
+  else if (ntables != 0)
+    inbroken[i] = !decode_streams(&settable[insel[i]], nstreams, inblock[i]+lensize[i], outblock[i], outsize[i]);
+  else
+    inbroken[i] = !decode_streams(&dectable, nstreams, inblock[i], outblock[i], outsize[i]);
+}
+
+/*
+ * function read_index
+ *
+ * Read block index of nblocks blocks at the end of blocked bin file,
+ * and seek to the first block, at binoffset. Kind of each block is set
+ * to kinds. The caller checks that the index fits in the file.
+ *
+ * Returns:
+ *      Encoded size of each block.
+ */
+int *read_index(FILE *binf, int nblocks, unsigned char **kinds)
+{
+  unsigned char *tmp = malloc(4*(size_t)nblocks + 1);
+  int *index = malloc(nblocks * sizeof(int) + 1);
+  int i;
+  *kinds = malloc(nblocks + 1);
+  if (tmp == NULL || index == NULL || *kinds == NULL) {
+    fprintf(stderr, "Out of memory!\n");
+    exit(1);
+  }
+  if (fseek(binf, -4L*nblocks, SEEK_END) != 0 || fread(tmp, 1, 4*(size_t)nblocks, binf) != 4*(size_t)nblocks) {
+    fprintf(stderr, "Broken bin file: %s\n", binfilename);
+    exit(1);
+  }
+  for (i=0; i<nblocks; i++) {
+    index[i] = tmp[4*i] | tmp[4*i+1] << 8 | tmp[4*i+2] << 16 | (tmp[4*i+3] & 0x3f) << 24;
+    (*kinds)[i] = tmp[4*i+3] >> (INDEX_KINDSHIFT - 24);
+  }
+  fseek(binf, binoffset, SEEK_SET);
+  free(tmp);
+  return index;
+}
+
+/*
+ * function read_tableset
+ *
+ * Read codes of table set by get_tableset() at binoffset of bin file,
+ * and make decoding tables of all of them, so blocks switch tables
+ * with no cost.
+ *
+ * Returns:
+ *      Number of bytes of the codes.
+ */
+int read_tableset(FILE *binf)
+{
+  unsigned char tables[MAX_TABLES*LENGTHS_MAXSIZE];
+  int t, n;
+  fseek(binf, binoffset, SEEK_SET);
+  n = get_tableset(tables, fread(tables, 1, sizeof(tables), binf));
+  if (n < 0) {
+    fprintf(stderr, "Broken bin file: %s\n", binfilename);
+    exit(1);
+  }
+  for (t=0; t<ntables; t++) {
+    settable[t].generic = generic;
+    make_dectable(&settable[t], &tablecode[t], originalsize);
+  }
+  return n;
+}
+
+/*
+ * Blocks block_reader() reads, with -q.
+ */
+int *readindex;  // encoded size of each block
+int readblock, readend, readmax;  // first block, block after the last, maximum size
+
+/*
+ * function block_reader
+ *
+ * Reader stage of writeoutfile_blocks(). Read blocks readblock to
+ * readend of bin file arg, one block to each buffer of inring. Size
+ * -1 is passed for a broken block.
+ */
+void block_reader(void *arg)
+{
+  FILE *binf = arg;
+  unsigned char *p;
+  int size;
+  for (; readblock < readend && (p = ring_empty(inring)) != NULL; readblock++) {
+    size = readindex[readblock];
+    if (size < 0 || size > readmax || fread(p, 1, size, binf) != size) size = -1;
+    ring_fill(inring, size);
+    if (size < 0) break;
+  }
+  ring_close(inring);
+}
+
+/*
+ * function writeoutfile_blocks
+ *
+ * Write out file from blocked bin file. Block index at the end tells
+ * encoded size of each block, so nthreads blocks are read at once and
+ * decoded at the same time by decode_streams() on nthreads threads,
+ * then written in order. Code lengths of blocks which have their own
+ * code are read by get_lengths() before their streams. Stored blocks
+ * and blocks of one character, by their kinds in the index, have no
+ * code lengths and no streams. With table set,
+ * the codes are read first by read_tableset(), and the index of the
+ * table is read before the streams of each block.
+ *
+ * With -m, blocks are decoded from the mapped bin file right into the
+ * mapped output file, and nothing is copied. Only a block without 8
+ * bytes after it in the file is copied to inbuf, for the refill.
+ *
+ * Each block starts at a point the decoder can start at, so with -r
+ * only blocks in the range are read and decoded. The block index gives
+ * the offset of the first one. Output is mapped only without -r.
+ *
+ * With -q, blocks are read by block_reader() and written by the writer
+ * stage, one block in each buffer, while blocks are decoded.
+ */
+void writeoutfile_blocks()
+{
+  FILE *binf;
+  FILE *outf = NULL;
+  unsigned char *binmap = NULL, *outmap = NULL, *kinds;
+  int *index;
+  long long encodedsize=binoffset, remainedsize, binsize=0, offset=binoffset, blocks;
+  int i, n, size, maxsize, nblocks, block, endblock;
+
+  if (usemmap && rangesize == originalsize) outmap = map_outfile(outfilename, originalsize);
+  if (outmap == NULL) outf = fopen(outfilename, "wb");
+  binf = fopen(binfilename, "rb");
+  if (binf == NULL) {  // file not found error
+    file_error(binfilename);
+    exit(1);
   }
-  fwrite(wbuf, 1, writesize, outf);  // file write for remained bytes
-  fclose(outf);
+  stats_phase(stats, PHASE_IO);
+  blocks = originalsize / blocksize + (originalsize % blocksize != 0);
+  if (blocks > INT_MAX / 4 || fseek(binf, 0, SEEK_END) != 0 ||
+      blocks > (ftell(binf) - binoffset) / 4) {  // index must fit in the file
+    fprintf(stderr, "Broken bin file: %s\n", binfilename);
+    exit(1);
+  }
+  nblocks = blocks;
+  index = read_index(binf, nblocks, &kinds);
+  if (ntables != 0) {  // codes of table set, before the first block
+    stats_phase(stats, PHASE_CODE);
+    n = read_tableset(binf);
+    stats_phase(stats, PHASE_IO);
+    offset += n;
+    encodedsize += n;
+    fseek(binf, offset, SEEK_SET);
+  }
+  block = rangestart / blocksize;  // blocks of the range
+  endblock = (rangesize == 0 ? block : (rangestart + rangesize + blocksize - 1) / blocksize);
+  for (i=0; i<block; i++) offset += index[i];  // skip blocks before the range
+  if (block != 0) fseek(binf, offset, SEEK_SET);
+  if (usemmap) binmap = map_infile(binfilename, &binsize);
+  maxsize = (blocktables ? LENGTHS_MAXSIZE : ntables != 0 ? 1 : 0) + STREAMS_BOUND(blocksize);
+  readindex = index;
+  readblock = block;
+  readend = endblock;
+  readmax = maxsize;
+  start_pipeline(block_reader, (binmap == NULL ? binf : NULL), maxsize + 8, outf, blocksize);
+  for (i=0; i<nthreads; i++) {
+    inblock[i] = inbuf[i] = (inring != NULL ? NULL : malloc(maxsize + 8));  // 8 bytes for refill
+    outblock[i] = outbuf[i] = (outring != NULL ? NULL : malloc(blocksize));
+    if ((inbuf[i] == NULL && inring == NULL) || (outbuf[i] == NULL && outring == NULL)) {
+      fprintf(stderr, "Out of memory!\n");
+      exit(1);
+    }
+  }
+  while (block < endblock) {
+    for (n=0; n<nthreads && block+n < endblock; n++) {  // read blocks
+      size = index[block+n];
+      inkind[n] = kinds[block+n];
+      remainedsize = originalsize - (long long)(block+n) * blocksize;
+      outsize[n] = (remainedsize < blocksize ? remainedsize : blocksize);
+      if (size > maxsize || (inkind[n] == BLOCK_CODED && size < 4*nstreams) ||
+          (inkind[n] == BLOCK_STORED && size != outsize[n]) || (inkind[n] == BLOCK_RUN && size != 1) ||
+          inkind[n] > BLOCK_RUN)
+        break;
+      if (binmap != NULL) {  // point into the mapped file
+        if (size > binsize - 4*nblocks - offset) break;
+        inblock[n] = binmap + offset;
+        if (offset + size + 8 > binsize) {  // copy for the refill
+          memcpy(inbuf[n], inblock[n], size);
+          inblock[n] = inbuf[n];
+        }
+      }
+      else if (inring != NULL) {  // read by the reader stage
+        inblock[n] = ring_full(inring, &i);
+        if (inblock[n] == NULL || i != size) break;
+      }
+      else if (fread(inblock[n], 1, size, binf) != size)
+        break;
+      offset += size;
+      lensize[n] = 0;
+      if (inkind[n] == BLOCK_CODED) {  // stored or filled blocks have no code and no streams
+        if (blocktables) {  // code lengths of the block
+          lensize[n] = get_lengths(inblock[n], size, &blockcode[n]);
+          if (lensize[n] < 0) break;
+        }
+        else if (ntables != 0) {  // index of the table of the block
+          insel[n] = inblock[n][0];
+          lensize[n] = 1;
+          if (size < 1 || insel[n] >= ntables) break;
+        }
+        if (!check_streams(inblock[n] + lensize[n], size - lensize[n], nstreams)) break;
+      }
+      if (binmap == NULL || inblock[n] == inbuf[n]) memset(inblock[n] + index[block+n], 0, 8);
+      if (outmap != NULL) outblock[n] = outmap + (long long)(block+n) * blocksize;
+      else if (outring != NULL) outblock[n] = ring_empty(outring);
+      encodedsize += index[block+n];
+    }
+    if (n == 0 || (n < nthreads && block+n < endblock)) {
+      fprintf(stderr, "Broken bin file: %s\n", binfilename);
+      exit(1);
+    }
+    stats_phase(stats, PHASE_CODING);
+    run_jobs(nthreads, n, decode_job, NULL);  // decode blocks
+    for (i=0; i<n; i++)
+      if (inbroken[i]) {
+        fprintf(stderr, "Broken bin file: %s\n", binfilename);
+        exit(1);
+      }
+    stats_phase(stats, PHASE_HISTOGRAM);
+    for (i=0; i<n && stats != NULL; i++) {
+      if (inkind[i] != BLOCK_CODED) stats_stored(stats, outblock[i], outsize[i], 8LL*index[block+i]);
+      else stats_count(stats, outblock[i], outsize[i],
+                       (blocktables ? &blockcode[i] : ntables != 0 ? &tablecode[insel[i]] : &filecode));
+    }
+    stats_phase(stats, PHASE_IO);
+    for (i=0; i<n; i++, block++) {  // write blocks
+      if (outmap == NULL) write_range(outblock[i], (long long)block * blocksize, outsize[i], outf);
+      if (inring != NULL) ring_release(inring);
+    }
+  }
+  encodedsize += 4*nblocks;
+  end_pipeline();
+  if (outmap != NULL) unmap_file(outmap, originalsize);
+  else fclose(outf);
+  if (binmap != NULL) unmap_file(binmap, binsize);
+  fclose(binf);
+  for (i=0; i<nthreads; i++) {
+    free(inbuf[i]);
+    free(outbuf[i]);
+    free_dectable(&blocktable[i]);
+  }
+  for (i=0; i<ntables; i++) free_dectable(&settable[i]);
+  free(index);
+  free(kinds);
+  if (stats != NULL) {
+    stats->bytesin = encodedsize;
+    stats->bytesout = rangesize;
+  }
+  printf("%lld bytes(%3.1f) -> %lld bytes\n", encodedsize, (double)encodedsize/originalsize*100, rangesize);
+}
+
+/*
+ * Coding state of each block of stream, with -p.
+ */
+huff_pointer blockhuff[MAX_THREADS];
+long long blockpos[MAX_THREADS];  // characters before each block
+
+/*
+ * function in_range
+ *
+ * Returns:
+ *      1 if block i of stream is in the range of -r, 0 if not.
+ */
+int in_range(int i)
+{
+  return blockpos[i] + blockhuff[i]->chars > rangestart && blockpos[i] < rangestart + rangesize;
+}
+
+/*
+ * function stream_job
+ *
+ * Decode block i of stream, if it is in the range of -r, and set
+ * inbroken[i] if it is broken. Run by run_jobs().
+ */
+void stream_job(void *arg, int i)
+{
+  inbroken[i] = (in_range(i) && huff_decode_block(blockhuff[i], inblock[i], outblock[i]) < 0);
+}
+
+/*
+ * function stream_reader
+ *
+ * Reader stage of readstream(). Read blocks of stream arg, one block
+ * to each buffer of inring, until the end of stream or the end of the
+ * range of -r. Size -1 is passed for a broken block.
+ */
+void stream_reader(void *arg)
+{
+  FILE *binf = arg;
+  unsigned char *p;
+  long long pos = 0;
+  int size;
+  while (pos < rangestart + rangesize && (p = ring_empty(inring)) != NULL) {
+    size = -1;
+    if (fread(p, 1, BLOCKHEAD_SIZE, binf) == BLOCKHEAD_SIZE) {
+      size = huff_block_size(p);
+      if (size < 0 || size > STREAM_BLOCK_BOUND(blocksize) ||
+          fread(p + BLOCKHEAD_SIZE, 1, size - BLOCKHEAD_SIZE, binf) != size - BLOCKHEAD_SIZE)
+        size = -1;
+    }
+    if (size >= 0 && p[0] != 'E' && huff_block_chars(p) < 0) size = -1;  // too many characters
+    if (size < 0 || p[0] == 'E') {
+      ring_fill(inring, size);
+      break;
+    }
+    pos += huff_block_chars(p);  // characters of the block
+    ring_fill(inring, size);
+  }
+  ring_close(inring);
+}
+
+/*
+ * function readstream
+ *
+ * Write out file from the stream which huffenc wrote with -p, by
+ * functions of hufflib.c. Blocks are read in order until the end of
+ * stream, and nthreads blocks are decoded at the same time, each by
+ * its own huff_struct. A block with kind 'C' has its own code lengths,
+ * and a block with kind 'R' uses the code of the block before. Blocks
+ * with kind 'S' and 'F' are copied and filled. Only nthreads blocks
+ * are in memory at once.
+ *
+ * With -r, blocks before the range are read for their codes but not
+ * decoded, and reading stops after the range.
+ *
+ * With -q, blocks are read by stream_reader() and written by the
+ * writer stage, one block in each buffer, while blocks are decoded.
+ */
+void readstream()
+{
+  FILE *binf, *outf;
+  huff_pointer prev;
+  long long encodedsize;
+  int i, n, size, held, end=0;
+
+  stats_phase(stats, PHASE_IO);
+  binf = (strcmp(binfilename, "-") == 0 ? stdin : fopen(binfilename, "rb"));
+  if (binf == NULL) {
+    file_error(binfilename);
+    exit(1);
+  }
+  for (i=0; i<nthreads; i++) {
+    blockhuff[i] = huff_new(0, 0, 0);
+    if (blockhuff[i] == NULL) {
+      fprintf(stderr, "Out of memory!\n");
+      exit(1);
+    }
+    blockhuff[i]->table.generic = generic;
+  }
+  if (fread(buf, 1, 5, binf) != 5 || fread(buf+5, 1, buf[4], binf) != buf[4] ||
+      huff_get_header(blockhuff[0], buf, 5 + buf[4]) < 0) {
+    fprintf(stderr, "Not a stream: %s\n", binfilename);
+    exit(1);
+  }
+  encodedsize = 5 + buf[4];
+  for (i=1; i<nthreads; i++) huff_get_header(blockhuff[i], buf, encodedsize);
+  blocksize = blockhuff[0]->opt.blocksize;
+  outf = (strcmp(outfilename, "-") == 0 ? stdout : fopen(outfilename, "wb"));
+  if (outf == NULL) {
+    file_error(outfilename);
+    exit(1);
+  }
+  start_pipeline(stream_reader, binf, STREAM_BLOCK_BOUND(blocksize) + 8, outf, blocksize);
+  for (i=0; i<nthreads; i++) {
+    inblock[i] = inbuf[i] = (inring != NULL ? NULL : malloc(STREAM_BLOCK_BOUND(blocksize) + 8));  // 8 bytes for refill
+    outblock[i] = outbuf[i] = (outring != NULL ? NULL : malloc(blocksize));
+    if ((inbuf[i] == NULL && inring == NULL) || (outbuf[i] == NULL && outring == NULL)) {
+      fprintf(stderr, "Out of memory!\n");
+      exit(1);
+    }
+  }
+  prev = blockhuff[0];  // no code yet
+  while (!end) {
+    for (n=0, held=0; n<nthreads; n++) {  // read blocks
+      if (inring != NULL) {  // read by the reader stage
+        inblock[n] = ring_full(inring, &size);
+        if (inblock[n] == NULL) break;
+        held++;
+        if (size < 0) break;
+      }
+      else {
+        if (fread(inblock[n], 1, BLOCKHEAD_SIZE, binf) != BLOCKHEAD_SIZE) break;
+        size = huff_block_size(inblock[n]);
+        if (size < 0 || size > STREAM_BLOCK_BOUND(blocksize) ||
+            fread(inblock[n] + BLOCKHEAD_SIZE, 1, size - BLOCKHEAD_SIZE, binf) != size - BLOCKHEAD_SIZE)
+          break;
+      }
+      memset(inblock[n] + size, 0, 8);
+      if (huff_read_block(blockhuff[n], inblock[n], size + 8, prev) < 0) break;
+      encodedsize += size;
+      if (blockhuff[n]->kind == 'E') {  // end of stream
+        end = 1;
+        break;
+      }
+      if (outring != NULL) outblock[n] = ring_empty(outring);
+      prev = blockhuff[n];
+      blockpos[n] = originalsize;
+      originalsize += blockhuff[n]->chars;
+    }
+    if (originalsize >= rangestart + rangesize) end = 1;  // the rest is not needed
+    if (n < nthreads && !end) {
+      fprintf(stderr, "Broken stream: %s\n", binfilename);
+      exit(1);
+    }
+    stats_phase(stats, PHASE_CODING);
+    if (n > 0) run_jobs(nthreads, n, stream_job, NULL);  // decode blocks
+    for (i=0; i<n; i++)
+      if (inbroken[i]) {
+        fprintf(stderr, "Broken stream: %s\n", binfilename);
+        exit(1);
+      }
+    stats_phase(stats, PHASE_HISTOGRAM);
+    for (i=0; i<n; i++)
+      if (in_range(i)) stats_count(stats, outblock[i], blockhuff[i]->chars, &blockhuff[i]->code);
+    stats_phase(stats, PHASE_IO);
+    for (i=0; i<n; i++)  // write blocks
+      write_range(outblock[i], blockpos[i], blockhuff[i]->chars, outf);
+    for (; held > 0; held--) ring_release(inring);
+  }
+  end_pipeline();
+  if (stats != NULL) {
+    stats->bytesin = encodedsize;
+    stats->bytesout = (rangestart >= originalsize ? 0 :
+                       rangesize < originalsize - rangestart ? rangesize : originalsize - rangestart);
+  }
+  // stdout may be the output, so the result goes to stderr
+  fprintf(stderr, "%lld bytes(%3.1f) -> %lld bytes\n", encodedsize, (double)encodedsize/originalsize*100, originalsize);
+  for (i=0; i<nthreads; i++) {
+    huff_free(blockhuff[i]);
+    free(inbuf[i]);
+    free(outbuf[i]);
+  }
+  if (binf != stdin) fclose(binf);
+  if (outf != stdout) fclose(outf);
+  else fflush(stdout);
+}
+
+/*
+ * function write_stats
+ *
+ * Write stats of --stats, if wanted.
+ */
+void write_stats()
+{
+  if (stats == NULL) return;
+  stats_print(stats, statsf, "huffdec");
+  if (statsf != stderr) fclose(statsf);
+}
+
+/*
+ * function read_size
+ *
+ * Read original size at the start of bin file encoded by dictionary,
+ * which the dictionary doesn't have, and set binoffset after it.
+ */
+void read_size()
+{
+  FILE *binf;
+  unsigned char size[VARSIZE_MAXSIZE];
+  int n;
+  binf = fopen(binfilename, "rb");
+  if (binf == NULL) {
+    file_error(binfilename);
+    exit(1);
+  }
+  n = get_varsize(size, fread(size, 1, sizeof(size), binf), &originalsize);
   fclose(binf);
-  printf("%d bytes(%3.1f) -> %d bytes\n", encodedsize, (double)encodedsize/originalsize*100, originalsize);
+  if (n < 0) {
+    fprintf(stderr, "Broken bin file: %s\n", binfilename);
+    exit(1);
+  }
+  binoffset = n;
 }
 
 /*
@@ -83,27 +842,149 @@ void writeoutfile()
  *
  * This utility can take arguments.
  *
- * Three Steps :::
+ * Five Steps :::
  *   1. Read frequency file.
  *   2. Make huffman tree.
- *   3. Write output file.
+ *   3. Make huffman code.
+ *   4. Make decoding table.
+ *   5. Write output file.
+ *
+ * If frq_file is code length file of canonical huffman code, steps 1~3
+ * are just reading code lengths and making canonical code from them.
+ * Container file has code lengths in its header, and step 5 starts
+ * after the header. With a dictionary, step 5 starts after the size at
+ * the start of bin file.
+ * If each block has its own code, steps 3~4 are done for each block.
+ * With -p, steps 1~4 are done for each block while reading stream.
+ *
+ * With --stats, each step is timed as its phase, and stats are written
+ * at the end.
  */
 int main(int argc, char *argv[])
 {
+  static struct option longopts[] = {
+    { "stats", optional_argument, NULL, 'S' },
+    { "generic", no_argument, NULL, 'G' },
+    { NULL, 0, NULL, 0 }
+  };
+  static stats_struct statsdata;
+  char *listfilename = NULL;  // list of bin files, with -a
+  char **files;
+  int opt, streaming=0, batch=0, nfiles;
+  while ((opt = getopt_long(argc, argv, "ampt:r:q:f:", longopts, NULL)) != -1) {
+    switch (opt) {
+    case 'S':  // time and counters of phases
+      stats_init(&statsdata, 1);
+      stats = &statsdata;
+      statsf = stderr;  // stdout may be the output
+      if (optarg != NULL && (statsf = fopen(optarg, "w")) == NULL) {
+        file_error(optarg);
+        return 1;
+      }
+      break;
+    case 'G':  // no kernel for short codes
+      generic = 1;
+      break;
+    case 'm':  // map files to memory
+      usemmap = 1;
+      break;
+    case 'p':  // stream mode
+      streaming = 1;
+      break;
+    case 'a':  // batch mode
+      batch = 1;
+      break;
+    case 'f':  // list of bin files
+      listfilename = optarg;
+      break;
+    case 't':  // number of threads
+      nthreads = atoi(optarg);
+      if (nthreads < 1 || nthreads > MAX_THREADS) {
+        fprintf(stderr, "nthreads must be 1 to %d\n", MAX_THREADS);
+        return 1;
+      }
+      break;
+    case 'r':  // range to decode
+      if (sscanf(optarg, "%lld,%lld", &rangestart, &rangesize) < 1 || rangestart < 0 || rangesize < -1) {
+        fprintf(stderr, "range must be offset[,length]\n");
+        return 1;
+      }
+      break;
+    case 'q':  // pipeline with buffers
+      iosize = DEF_IOSIZE / 1024;
+      if (sscanf(optarg, "%d,%d", &nbuffers, &iosize) < 1 || nbuffers < 1 || nbuffers > MAX_BUFFERS ||
+          iosize < 4 || iosize > MAX_BLOCKSIZE / 1024) {
+        fprintf(stderr, "nbuffers must be 1 to %d, bufsize %d to %d\n", MAX_BUFFERS, 4, MAX_BLOCKSIZE/1024);
+        return 1;
+      }
+      iosize *= 1024;
+      break;
+    default:
+      fprintf(stderr, "Usage: huffdec [-mp] [-t nthreads] [-r offset[,length]] [-q nbuffers[,bufsize]]\n"
+              "               [--stats[=stats_file]] [--generic] [output_file] [bin_file] [frq_file]\n"
+              "       huffdec -a [-t nthreads] [-f list_file] [bin_file]...\n");
+      return 1;
+    }
+  }
+  argc -= optind - 1;  // arguments after options are file names
+  argv += optind - 1;
+
+  if (listfilename != NULL && !batch) {
+    fprintf(stderr, "-f can be used only with -a\n");
+    return 1;
+  }
+  if (batch) {  // many streams, each to its own file
+    if (usemmap || streaming || nbuffers != 0 || rangestart != 0 || rangesize != -1 || stats != NULL || generic) {
+      fprintf(stderr, "-a can't be used with -m, -p, -r, -q, --stats or --generic\n");
+      return 1;
+    }
+    files = read_filelist(listfilename, argv+1, argc-1, &nfiles);
+    return (run_batch(files, nfiles, 1, nthreads, 0, 0, 0) != 0);
+  }
+
   if (argc < 2)
-    strcpy(outfilename,DEF_OUTFILE);
+    strcpy(outfilename, streaming ? "-" : DEF_OUTFILE);
   else
     strcpy(outfilename,argv[1]);
   if (argc < 3)
-    strcpy(binfilename,DEF_BINFILE);
+    strcpy(binfilename, streaming ? "-" : DEF_BINFILE);
   else
     strcpy(binfilename,argv[2]);
   if (argc < 4)
     strcpy(frqfilename,DEF_FRQFILE);
   else
     strcpy(frqfilename,argv[3]);
-  read_frqfile();   // Read frequency file.
-  make_hufftree();  // Make huffman tree.
-  writeoutfile();   // Write output file.
+  if (rangesize < 0) rangesize = LLONG_MAX - rangestart;  // to the end
+  if (streaming) {
+    readstream();  // Codes are in the stream.
+    write_stats();
+    return 0;
+  }
+  stats_phase(stats, PHASE_IO);
+  if (read_container() || read_lenfile()) {  // Read container or code length file,
+    stats_phase(stats, PHASE_CODE);
+    make_canonical(&filecode);  // and make canonical code.
+    if (dictionary) read_size();  // Size is in bin file.
+  }
+  else {
+    read_frqfile();       // Read frequency file.
+    stats_phase(stats, PHASE_TREE);
+    make_hufftree();      // Make huffman tree.
+    stats_phase(stats, PHASE_CODE);
+    make_huffcode(root);  // Make huffman code.
+  }
+  if ((blocktables || ntables != 0) && blocksize == 0) {
+    fprintf(stderr, "Broken code length file: %s\n", frqfilename);
+    return 1;
+  }
+  if (rangestart > originalsize) rangestart = originalsize;  // range in the file
+  if (rangesize > originalsize - rangestart) rangesize = originalsize - rangestart;
+  dectable.generic = generic;
+  make_dectable(&dectable, &filecode, originalsize);  // Make decoding table.
+  if (blocksize != 0)
+    writeoutfile_blocks();  // Write output file from blocks.
+  else
+    writeoutfile();       // Write output file.
+  write_stats();
   return 0;
 }
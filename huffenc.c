@@ -4,8 +4,91 @@
  * Utility for encoding huffman code.
  *
  * Usage:
- *   huffenc [input_file] [bin_file] [frq_file]
- * 
+ *   huffenc [-c1kmp] [-l maxbits] [-s nstreams] [-t nthreads] [-b blocksize]
+ *           [-g ntables] [-q nbuffers[,bufsize]] [--stats[=stats_file]] [input_file] [bin_file] [frq_file]
+ *   huffenc -w dict_file [-l maxbits] [-t nthreads] [input_file]...
+ *   huffenc -d dict_file [-m] [-q nbuffers[,bufsize]] [--stats[=stats_file]] [input_file] [bin_file]
+ *   huffenc -a [-l maxbits] [-s nstreams] [-t nthreads] [-b blocksize] [-f list_file] [input_file]...
+ *
+ * -c: canonical huffman code. frq_file saves code lengths instead of
+ *   frequencies, so it is smaller and huffdec needs no huffman tree.
+ *   Code lengths are limited to 15 bits.
+ * -l maxbits: limit the length of huffman codes to maxbits bits
+ *   (8 to 32, such as 11 to 15 for fast decoding tables). It is saved
+ *   in frq_file, so huffdec uses the same limit.
+ * -s nstreams: split each block into nstreams (2, 4 or 8) interleaved
+ *   streams, so huffdec can decode them in parallel. Files smaller
+ *   than 4 KB are still encoded as one stream.
+ * -t nthreads: count and encode nthreads blocks at the same time by
+ *   nthreads threads (1 to 64). huffdec can decode blocks with threads
+ *   too.
+ * -b blocksize: characters in one block, in Kilo Bytes (power of 2,
+ *   4 to 65536). Default 1024 KB. Each block is a point "huffdec -r"
+ *   can start decoding at, so smaller blocks make ranges faster.
+ * -m: map input_file to memory and encode it in place, instead of
+ *   reading it by fread. If input_file can't be mapped, such as a pipe,
+ *   it is read by fread.
+ * -1: read input_file only once. Each block is encoded by its own
+ *   canonical code, made from the block and saved before it, so
+ *   frequencies of the whole file are not counted first. frq_file is
+ *   a code length file with original size and options only.
+ * -g ntables: table set mode, for files whose parts have different
+ *   frequencies, such as text headers before binary data. Up to
+ *   ntables (2 to 8) canonical codes are made from frequencies of
+ *   blocks, and each block is encoded by the one that codes it best,
+ *   with one byte for its index. The codes are saved once at the start
+ *   of bin_file. huffdec makes decoding tables of all of them first.
+ *   Can be used with -k, -s, -t, -b, -m and -q.
+ * -w dict_file: train a dictionary from all input_files, for many small
+ *   inputs which have similar frequencies, such as messages. The
+ *   dictionary is a code length file of canonical code made from the
+ *   frequencies of all of them, where every character has a code, so
+ *   any input can be encoded by it. No bin_file is written.
+ * -d dict_file: encode input_file by the dictionary, instead of its own
+ *   code. Frequencies are not counted and no frq_file is written, so
+ *   input_file is read once, and bin_file has only its size, 1 or 2
+ *   bytes for inputs under 16 KB, before the codes. "huffdec" decodes
+ *   it with dict_file as frq_file. Not blocked, so -1, -k, -p, -g, -s
+ *   and -b can't be used.
+ * -k: container mode. Code lengths of canonical huffman code and the
+ *   encoded data are saved to one container file, bin_file, and no
+ *   frq_file is written. huffdec finds out that bin_file is container
+ *   file. Can be used with -1, -s, -t, -b and -m.
+ *   The stream of -p is one file already, so -k is not needed there.
+ * -p: stream mode, for pipes. Input is read once by blocks, and one
+ *   self-describing stream is written to bin_file, with the codes of
+ *   blocks in it and no frq_file. input_file and bin_file are "-"
+ *   (standard input and output) by default. Memory used doesn't
+ *   depend on input size.
+ * -q nbuffers[,bufsize]: pipeline mode. A reader thread reads input_file
+ *   ahead and a writer thread writes bin_file behind, while blocks are
+ *   encoded, so I/O and encoding overlap. Each has a ring of nthreads +
+ *   nbuffers (1 to 64) buffers. Buffers hold one block, or bufsize Kilo
+ *   Bytes (4 to 65536, default 64) if bin file is not blocked. Counting
+ *   frequencies before encoding is not pipelined.
+ * -a: batch mode, for many files. Each input_file is encoded as a
+ *   whole to the stream of -p, saved as input_file with ".huf" added,
+ *   and "huffdec -a" decodes it back. Files are shared by a pool of
+ *   nthreads threads, each keeping its buffers for all files it
+ *   encodes, and totals of all files are printed at the end. A file
+ *   that can't be encoded is reported and skipped. Can be used with
+ *   -l, -s, -t, -b and -f.
+ * -f list_file: with -a, also encode the files named in list_file, one
+ *   on each line. "-" reads the names from standard input.
+ * --stats[=stats_file]: write wall clock and CPU time of each phase
+ *   (histogram, tree, code, encode and io), bytes in and out, the
+ *   longest code length, average bits of codes and entropy as one line
+ *   of JSON to stats_file, or to standard error. Histogram includes
+ *   reading input_file to count it and writing frq_file. Blocks coded
+ *   on threads are timed as a whole, so with -1 making codes of blocks
+ *   is timed as encode, and with -p as histogram.
+ *
+ * With -s, -t, -b, -g or -1, bin file is blocked: blocks of blocksize
+ * characters are encoded independently, and block index is saved at
+ * the end. A block which huffman code can't make smaller is stored as
+ * it is, and a block of one character is saved as that character. A
+ * file like that is blocked by default blocksize even with no option.
+ *
  * Default input_file = "huffman.in"
  * Default bin_file = "huffman.bin"
  * Defailt frq_file = "huffman.frq"
@@ -16,66 +99,584 @@
  * Date: 2003/11/22
  */
 #include <stdio.h>
-#include "huff.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include "hufflib.h"
+#include "pool.h"
+#include "batch.h"
 
 extern char infilename[256], binfilename[256], frqfilename[256];
-extern int frq[256], bitlength[256], huffcode[256], tmplen, tmpcode;
+extern long long frq[256], originalsize, encodedsize, inmapsize;
+extern int tmplen, tmpcode;
+extern code_struct filecode;
 extern unsigned char buf[BUFSIZ], wbuf[BUFSIZ];
-extern int originalsize, encodedsize;
-extern heap_pointer h;
-extern tnode_pointer root;
+extern int maxbits, nstreams, blocksize, nthreads, blocktables, usemmap, nbuffers, iosize;
+extern int ntables;
+extern code_struct tablecode[MAX_TABLES];
+extern unsigned char *inmap, *blocksel;
+extern long long (*blockfrq)[256];
+extern int dictionary;
+extern int root;
+
+int canonical=0;  // 1 if canonical huffman code is used
+int streaming=0;  // 1 if stream is written, with -p
+int container=0;  // 1 if container file is written, with -k
+stats_pointer stats=NULL;  // time and counters of encoding, with --stats
+ring_pointer inring=NULL, outring=NULL;  // buffers of reader and writer stages, with -q
+stage_pointer readstage, writestage;
+
+/*
+ * function start_pipeline
+ *
+ * With -q, start a reader stage which reads inf to buffers of insize
+ * bytes, unless inf is NULL as input file is mapped, and a writer
+ * stage which writes buffers of outsize bytes to binf. Each ring has
+ * nbuffers buffers more than threads, so the reader reads ahead and
+ * the writer writes behind while nthreads buffers are encoded.
+ */
+void start_pipeline(FILE *inf, int insize, FILE *binf, int outsize)
+{
+  if (nbuffers == 0) return;
+  if (inf != NULL) inring = ring_new(nthreads + nbuffers, insize);
+  outring = ring_new(nthreads + nbuffers, outsize);
+  if ((inf != NULL && inring == NULL) || outring == NULL) {
+    fprintf(stderr, "Out of memory!\n");
+    exit(1);
+  }
+  if (inring != NULL) readstage = start_reader(inring, inf);
+  writestage = start_writer(outring, binf);
+}
+
+/*
+ * function end_pipeline
+ *
+ * End the stages of start_pipeline(), after the writer has written
+ * all filled buffers, so binf can be written again.
+ */
+void end_pipeline()
+{
+  if (inring != NULL) {
+    ring_drain(inring);
+    join_stage(readstage);
+    ring_free(inring);
+    inring = NULL;
+  }
+  if (outring != NULL) {
+    ring_close(outring);
+    join_stage(writestage);
+    ring_free(outring);
+    outring = NULL;
+  }
+}
+
+/*
+ * function read_chunk
+ *
+ * Point *in to the next chunk of input file, from done. The chunk is
+ * in the mapped file, or in a buffer of the reader stage, which must
+ * be released after it is encoded, or read to buf.
+ *
+ * Returns:
+ *      Bytes of the chunk, 0 at the end of file.
+ */
+int read_chunk(FILE *inf, unsigned char **in, long long done)
+{
+  int size;
+  if (inmap != NULL) {
+    *in = inmap + done;
+    return (inmapsize - done < COUNT_CHUNK ? inmapsize - done : COUNT_CHUNK);
+  }
+  if (inring != NULL) {
+    *in = ring_full(inring, &size);  // the last one has 0 bytes
+    return size;
+  }
+  *in = buf;
+  return fread(buf, 1, BUFSIZ, inf);
+}
+
+/*
+ * function write_chunk
+ *
+ * Write size bytes of out to binf, or pass them to the writer stage.
+ *
+ * Returns:
+ *      Buffer for the next chunk.
+ */
+unsigned char *write_chunk(unsigned char *out, int size, FILE *binf)
+{
+  if (outring == NULL) {
+    fwrite(out, 1, size, binf);
+    return out;
+  }
+  ring_fill(outring, size);
+  return ring_empty(outring);
+}
+
+/*
+ * function write_container
+ *
+ * With -k, write the header of container file made by put_container()
+ * at the start of binf. With -1, it is written again at the end, when
+ * original size is known. The header has the same size both times.
+ */
+void write_container(FILE *binf)
+{
+  unsigned char header[CONTAINER_MAXSIZE];
+  int n = put_container(header);
+  if (ftell(binf) == 0) encodedsize += n;  // count only once
+  else rewind(binf);
+  fwrite(header, 1, n, binf);
+}
 
 /*
  * function writebinfile()
  *
  * Write bin file with huffman encoding.
  * Block read/write for faster file I/O.
+ *
+ * pack_codes() appends whole codes and writes whole words to wbuf, so
+ * there is no loop for each bit. If input file is mapped, the file
+ * is encoded in place by COUNT_CHUNK bytes, so sizes of pack_codes()
+ * stay in int.
+ *
+ * With -q, chunks of iosize bytes are read by the reader stage and
+ * written by the writer stage, instead of buf and wbuf.
+ *
+ * With -d, original size is written first by put_varsize(), as the
+ * dictionary doesn't have it, and characters are counted for stats
+ * while they are encoded.
  */
 void writebinfile()
 {
   FILE *binf;
-  FILE *inf;
-  unsigned char tmp=0;
-  int i, j, tmpsaved=0, readsize, writesize=0;
-  inf = fopen(infilename, "rb");
-  if (inf == NULL) {
-    file_error(infilename);
-    exit(1);
+  FILE *inf = NULL;
+  packer_struct pk = { 0, 0 };
+  unsigned char *in, *out = wbuf, size[VARSIZE_MAXSIZE];
+  long long done=0;
+  int i, readsize, writesize=0, outcap = BUFSIZ;
+  if (inmap == NULL) {
+    inf = fopen(infilename, "rb");
+    if (inf == NULL) {
+      file_error(infilename);
+      exit(1);
+    }
   }
   binf = fopen(binfilename, "wb");
-  while ( (readsize = fread(buf, 1, BUFSIZ, inf)) != 0 ) {  // for each block
-    for (i=0; i<readsize; i++) {   // for each read byte
-      for (j=bitlength[(int)buf[i]]-1; j>=0; j--) {  // for each bits
-        tmpsaved++;
-        // add bits
-        tmp = (tmp << 1) | ((huffcode[(int)buf[i]] >> j) & 1);
-        // if 8 bits saved
-        if (tmpsaved == 8) {
-          // save the byte and go to next byte
-          wbuf[writesize++] = tmp;
-          tmp = 0;
-          tmpsaved = 0;
-          if (writesize==BUFSIZ) {   // if buffer full
-            fwrite(wbuf, 1, BUFSIZ, binf);   // write buffer
-            putchar('.');   // put one point for each block
-            fflush(stdout);
-            writesize = 0;
-            encodedsize += BUFSIZ;
-          }
-        }
+  if (container) write_container(binf);
+  if (dictionary) {  // size of input
+    i = put_varsize(originalsize, size);
+    fwrite(size, 1, i, binf);
+    encodedsize += i;
+  }
+  start_pipeline(inf, iosize, binf, iosize);
+  if (outring != NULL) {
+    out = ring_empty(outring);
+    outcap = iosize;
+  }
+  stats_phase(stats, PHASE_IO);
+  while ( (readsize = read_chunk(inf, &in, done)) != 0 ) {  // for each block
+    done += readsize;
+    i = 0;
+    stats_phase(stats, PHASE_CODING);
+    while (i < readsize) {  // until all read bytes are encoded
+      i += pack_codes(&pk, &filecode, in+i, readsize-i, out, &writesize, outcap);
+      if (writesize + PACK_SLACK > outcap) {  // if buffer full
+        stats_phase(stats, PHASE_IO);
+        out = write_chunk(out, writesize, binf);  // write buffer
+        stats_phase(stats, PHASE_CODING);
+        encodedsize += writesize;
+        writesize = 0;
       }
     }
+    if (dictionary && stats != NULL) {  // not counted before
+      stats_phase(stats, PHASE_HISTOGRAM);
+      stats_count(stats, in, readsize, &filecode);
+    }
+    stats_phase(stats, PHASE_IO);
+    if (inring != NULL) ring_release(inring);
   }
 
-  if (tmpsaved != 0) wbuf[writesize++] = tmp << (8-tmpsaved);// save remainded bits
-  fwrite(wbuf, 1, writesize, binf);// save remainded bytes
+  writesize += flush_codes(&pk, out+writesize);  // save remainded bits
+  if (outring != NULL) ring_fill(outring, writesize);  // save remainded bytes
+  else fwrite(out, 1, writesize, binf);
+  end_pipeline();
   encodedsize += writesize;
-  putchar('.');
-  printf(" %d bytes(%3.1f%%)\n",encodedsize,(double)encodedsize/originalsize*100);
-  fclose(inf);
+  if (!dictionary) stats_code(stats, frq, &filecode);
+  else printf("%lld bytes -> ", originalsize);
+  printf("%lld bytes(%3.1f%%)\n",encodedsize,(double)encodedsize/originalsize*100);
+  if (inf != NULL) fclose(inf);
   fclose(binf);
 }
 
+/*
+ * Blocks encoded at once by writebinfile_blocks(), one for each thread.
+ * Blocks are in inbuf and outbuf, or in the mapped file or buffers of
+ * the stages.
+ */
+unsigned char *inblock[MAX_THREADS], *outblock[MAX_THREADS];
+unsigned char *inbuf[MAX_THREADS], *outbuf[MAX_THREADS];
+int insize[MAX_THREADS], outsize[MAX_THREADS];
+code_struct blockcode[MAX_THREADS];  // code of each block, with -1
+long long blockcounts[MAX_THREADS][256];  // frequencies of each block, with -1
+int insel[MAX_THREADS];  // table of each block, with -g
+long long *infrq[MAX_THREADS];  // frequencies of each block counted by count_frq()
+int outkind[MAX_THREADS];  // kind of each block, by block_kind()
+code_pointer outcode[MAX_THREADS];  // code each block is coded by
+long long *outfrq[MAX_THREADS];  // frequencies of each block
+
+/*
+ * function encode_job
+ *
+ * Encode block i of the blocks read at once. Run by run_jobs().
+ *
+ * If each block has its own code, the block is counted and its code
+ * is made first, and code lengths are saved by put_lengths() before
+ * the encoded block. With table set, the index of the table of the
+ * block is saved before it instead.
+ *
+ * The frequencies of the block choose its kind by block_kind(). A block
+ * of one character is saved as the character, and a block which coding
+ * doesn't make smaller is saved as it is, with no code lengths.
+ */
+void encode_job(void *arg, int i)
+{
+  int n = 0;
+  if (blocktables) {
+    memset(blockcounts[i], 0, sizeof(blockcounts[i]));
+    count_bytes(inblock[i], insize[i], blockcounts[i]);
+    make_blockcode(blockcounts[i], &blockcode[i], maxbits);
+    outcode[i] = &blockcode[i];
+    outfrq[i] = blockcounts[i];
+    n = put_lengths(&blockcode[i], outblock[i]);
+  }
+  else {
+    outcode[i] = (ntables != 0 ? &tablecode[insel[i]] : &filecode);
+    outfrq[i] = infrq[i];
+    if (ntables != 0) outblock[i][n++] = insel[i];
+  }
+  outkind[i] = block_kind(outfrq[i], insize[i], code_bits(outfrq[i], outcode[i]) + 8 * (n + 4*nstreams));
+  if (outkind[i] == BLOCK_RUN) {
+    outblock[i][0] = inblock[i][0];
+    outsize[i] = 1;
+  }
+  else if (outkind[i] == BLOCK_STORED) {
+    memcpy(outblock[i], inblock[i], insize[i]);
+    outsize[i] = insize[i];
+  }
+  else
+    outsize[i] = n + encode_streams(outcode[i], nstreams, inblock[i], insize[i], outblock[i]+n);
+}
+
+/*
+ * function writebinfile_blocks()
+ *
+ * Write blocked bin file. Input file is cut into blocks of blocksize
+ * characters, and each block is encoded by encode_streams() to its own
+ * bytes, so blocks can be encoded and decoded independently. nthreads
+ * blocks are read at once and encoded at the same time by nthreads
+ * threads, then written in order.
+ *
+ * After all blocks, block index is written: encoded size of each
+ * block, 4 bytes each, least significant byte first, with its kind
+ * in the top 2 bits, from INDEX_KINDSHIFT. Number of blocks
+ * is known from original size, so huffdec finds the index at the end
+ * and the offset of every block from it.
+ *
+ * If each block has its own code, original size is not known yet, so
+ * blocks are read until the end of file, counting original size, and
+ * the index grows as blocks are written.
+ *
+ * With table set, the codes of the set are written by put_tableset()
+ * before the first block, and each block starts with the index of its
+ * table, 1 byte.
+ *
+ * If input file is mapped, blocks are encoded in place and not read.
+ *
+ * With -q, blocks are read by the reader stage and written by the
+ * writer stage, one block in each buffer, while blocks are encoded.
+ */
+void writebinfile_blocks()
+{
+  FILE *binf;
+  FILE *inf = NULL;
+  unsigned char *index = NULL;
+  unsigned char tables[MAX_TABLES*LENGTHS_MAXSIZE];
+  long long done=0;
+  int i, n, nblocks, block=0;
+
+  if (inmap == NULL) {
+    inf = fopen(infilename, "rb");
+    if (inf == NULL) {
+      file_error(infilename);
+      exit(1);
+    }
+  }
+  binf = fopen(binfilename, "wb");
+  if (container) write_container(binf);
+  if (ntables != 0) {  // codes of table set
+    n = put_tableset(tables);
+    fwrite(tables, 1, n, binf);
+    encodedsize += n;
+  }
+  nblocks = (originalsize + blocksize - 1) / blocksize;
+  start_pipeline(inf, blocksize, binf, LENGTHS_MAXSIZE + STREAMS_BOUND(blocksize));
+  for (i=0; i<nthreads; i++) {
+    inblock[i] = inbuf[i] = (inf == NULL || inring != NULL ? NULL : malloc(blocksize));
+    outblock[i] = outbuf[i] = (outring != NULL ? NULL : malloc(LENGTHS_MAXSIZE + STREAMS_BOUND(blocksize)));
+    if ((inbuf[i] == NULL && inf != NULL && inring == NULL) || (outbuf[i] == NULL && outring == NULL)) {
+      fprintf(stderr, "Out of memory!\n");
+      exit(1);
+    }
+  }
+  stats_phase(stats, PHASE_IO);
+  while (blocktables || block < nblocks) {
+    for (n=0; n<nthreads && (blocktables || block+n < nblocks); n++) {  // read blocks
+      if (inmap != NULL) {  // point into the mapped file
+        inblock[n] = inmap + done;
+        insize[n] = (inmapsize - done < blocksize ? inmapsize - done : blocksize);
+      }
+      else if (inring != NULL)
+        inblock[n] = ring_full(inring, &insize[n]);
+      else
+        insize[n] = fread(inblock[n], 1, blocksize, inf);
+      if (insize[n] == 0) break;  // end of file
+      if (outring != NULL) outblock[n] = ring_empty(outring);
+      done += insize[n];
+      if (blocktables) originalsize += insize[n];
+      if (ntables != 0) insel[n] = blocksel[block+n];
+      if (!blocktables) infrq[n] = blockfrq[block+n];
+    }
+    if (n == 0) break;
+    stats_phase(stats, PHASE_CODING);
+    run_jobs(nthreads, n, encode_job, NULL);  // encode blocks
+    stats_phase(stats, PHASE_IO);
+    for (i=0; i<n && stats != NULL; i++) {
+      if (outkind[i] == BLOCK_CODED) stats_code(stats, outfrq[i], outcode[i]);
+      else stats_stored(stats, inblock[i], insize[i], 8*outsize[i]);
+    }
+    index = realloc(index, 4*(block+n));
+    if (index == NULL) {
+      fprintf(stderr, "Out of memory!\n");
+      exit(1);
+    }
+    for (i=0; i<n; i++, block++) {  // write blocks
+      if (outring != NULL) ring_fill(outring, outsize[i]);
+      else fwrite(outblock[i], 1, outsize[i], binf);
+      if (inring != NULL) ring_release(inring);
+      encodedsize += outsize[i];
+      index[4*block] = outsize[i];
+      index[4*block+1] = outsize[i] >> 8;
+      index[4*block+2] = outsize[i] >> 16;
+      index[4*block+3] = outsize[i] >> 24 | outkind[i] << (INDEX_KINDSHIFT - 24);
+    }
+    if (insize[n-1] < blocksize) break;  // end of file
+  }
+  end_pipeline();
+  if (block > 0) fwrite(index, 1, 4*block, binf);  // write block index, none if input is empty
+  encodedsize += 4*block;
+  if (container && blocktables) write_container(binf);  // with original size
+  if (blocktables) printf("%lld bytes -> ", originalsize);
+  printf("%lld bytes(%3.1f%%)\n",encodedsize,(double)encodedsize/originalsize*100);
+  for (i=0; i<nthreads; i++) {
+    free(inbuf[i]);
+    free(outbuf[i]);
+  }
+  free(index);
+  if (inf != NULL) fclose(inf);
+  fclose(binf);
+}
+
+/*
+ * Coding state of each block of stream, with -p.
+ */
+huff_pointer blockhuff[MAX_THREADS];
+
+/*
+ * function count_job
+ *
+ * Count block i of stream and make its own code. Run by run_jobs().
+ */
+void count_job(void *arg, int i)
+{
+  huff_count_block(blockhuff[i], inblock[i], insize[i]);
+}
+
+/*
+ * function stream_job
+ *
+ * Encode block i of stream. Run by run_jobs().
+ */
+void stream_job(void *arg, int i)
+{
+  outsize[i] = huff_write_block(blockhuff[i], inblock[i], insize[i], outblock[i]);
+}
+
+/*
+ * function writestream
+ *
+ * Write stream with -p, by functions of hufflib.c. Input is read by
+ * blocks of blocksize characters only once, so it can be a pipe. Each
+ * block is counted and gets its own canonical code. If the block is
+ * encoded as small by the code of the block before, as by its own code
+ * and code lengths, the code before is used again and code lengths are
+ * not saved. nthreads blocks are read and coded at once, each by its
+ * own huff_struct, so memory used doesn't grow with input size.
+ * With -q, blocks are read and written by the stages of the pipeline.
+ *
+ * Stream Structure :::
+ *  STREAM_MAGIC "HUFS", 4 bytes.
+ *  Size of options, 1 byte, and options made by put_options().
+ *  Each block:
+ *      Kind of block, 1 byte. 'C' if the block has its own code, 'R'
+ *      if the block uses the code of the block before, 'S' if the
+ *      block is stored as it is, 'F' if the block is filled with one
+ *      character.
+ *      Characters in the block, 4 bytes, least significant byte first.
+ *      Size of the rest of the block, 4 bytes.
+ *      For 'C', code lengths saved by put_lengths().
+ *      Streams made by encode_streams(), or the characters for 'S', or
+ *      the character for 'F'.
+ *  End of stream, kind 'E' and sizes 0.
+ */
+void writestream()
+{
+  FILE *inf, *binf;
+  unsigned char header[5+OPTIONS_MAXSIZE];
+  huff_pointer prev;
+  int i, n;
+
+  inf = (strcmp(infilename, "-") == 0 ? stdin : fopen(infilename, "rb"));
+  if (inf == NULL) {
+    file_error(infilename);
+    exit(1);
+  }
+  binf = (strcmp(binfilename, "-") == 0 ? stdout : fopen(binfilename, "wb"));
+  if (binf == NULL) {
+    file_error(binfilename);
+    exit(1);
+  }
+  for (i=0; i<nthreads; i++) {
+    blockhuff[i] = huff_new(maxbits, nstreams, blocksize);
+    if (blockhuff[i] == NULL) {
+      fprintf(stderr, "Out of memory!\n");
+      exit(1);
+    }
+  }
+  encodedsize = huff_put_header(blockhuff[0], header);
+  fwrite(header, 1, encodedsize, binf);
+  start_pipeline(inf, blocksize, binf, STREAM_BLOCK_BOUND(blocksize));
+  for (i=0; i<nthreads; i++) {
+    inblock[i] = inbuf[i] = (inring != NULL ? NULL : malloc(blocksize));
+    outblock[i] = outbuf[i] = (outring != NULL ? NULL : malloc(STREAM_BLOCK_BOUND(blocksize)));
+    if ((inbuf[i] == NULL && inring == NULL) || (outbuf[i] == NULL && outring == NULL)) {
+      fprintf(stderr, "Out of memory!\n");
+      exit(1);
+    }
+  }
+  prev = blockhuff[0];  // no code yet
+  do {
+    stats_phase(stats, PHASE_IO);
+    for (n=0; n<nthreads; n++) {  // read blocks
+      if (inring != NULL) inblock[n] = ring_full(inring, &insize[n]);
+      else insize[n] = fread(inblock[n], 1, blocksize, inf);
+      if (insize[n] == 0) break;  // end of file
+      if (outring != NULL) outblock[n] = ring_empty(outring);
+      originalsize += insize[n];
+    }
+    if (n == 0) break;
+    stats_phase(stats, PHASE_HISTOGRAM);
+    run_jobs(nthreads, n, count_job, NULL);  // make code of each block
+    stats_phase(stats, PHASE_CODE);
+    for (i=0; i<n; i++) {  // choose code of each block, in order
+      huff_choose_code(blockhuff[i], prev);
+      prev = blockhuff[i];
+    }
+    stats_phase(stats, PHASE_CODING);
+    run_jobs(nthreads, n, stream_job, NULL);  // encode blocks
+    stats_phase(stats, PHASE_IO);
+    for (i=0; i<n; i++) {  // write blocks
+      if (outring != NULL) ring_fill(outring, outsize[i]);
+      else fwrite(outblock[i], 1, outsize[i], binf);
+      if (inring != NULL) ring_release(inring);
+      encodedsize += outsize[i];
+      stats_code(stats, blockhuff[i]->counts, &blockhuff[i]->code);
+    }
+  } while (insize[n-1] == blocksize);
+  end_pipeline();
+  encodedsize += huff_put_end(header);  // end of stream
+  fwrite(header, 1, BLOCKHEAD_SIZE, binf);
+  // stdout may be the stream, so the result goes to stderr
+  fprintf(stderr, "%lld bytes -> %lld bytes(%3.1f%%)\n", originalsize, encodedsize,
+          (double)encodedsize/originalsize*100);
+  for (i=0; i<nthreads; i++) {
+    huff_free(blockhuff[i]);
+    free(inbuf[i]);
+    free(outbuf[i]);
+  }
+  if (inf != stdin) fclose(inf);
+  if (binf != stdout) fclose(binf);
+  else fflush(stdout);
+}
+
+/*
+ * function make_dictionary
+ *
+ * Count frequency of nfiles files by count_frq(), one after another,
+ * or of input_file if there are none, and write dictionary of them to frqfilename by make_lenfile().
+ * Characters which didn't appear are counted once, so they have codes
+ * too, and inputs the files didn't have can be encoded.
+ */
+void make_dictionary(char **files, int nfiles)
+{
+  int i;
+  stats_phase(stats, PHASE_HISTOGRAM);
+  if (nfiles == 0) count_frq();  // default input_file
+  for (i=0; i<nfiles; i++) {
+    strcpy(infilename, files[i]);
+    count_frq();  // add frequency of the file
+  }
+  for (i=0; i<256; i++)
+    if (frq[i] == 0) frq[i] = 1;
+  stats_phase(stats, PHASE_TREE);
+  make_hufftree();      // make huffman tree
+  stats_phase(stats, PHASE_CODE);
+  make_huffcode(root);  // make huffman code
+  make_canonical(&filecode);  // change to canonical code
+  stats_phase(stats, PHASE_IO);
+  make_lenfile();       // write dictionary
+}
+
+/*
+ * function read_dictionary
+ *
+ * Read dictionary frqfilename, which make_dictionary() wrote, and set
+ * originalsize to the size of input file, with -d.
+ */
+void read_dictionary()
+{
+  FILE *inf;
+  if (!read_lenfile() || !dictionary) {
+    fprintf(stderr, "Not a dictionary: %s\n", frqfilename);
+    exit(1);
+  }
+  make_canonical(&filecode);
+  if (inmap != NULL) originalsize = inmapsize;
+  else {
+    inf = fopen(infilename, "rb");
+    if (inf == NULL) {
+      file_error(infilename);
+      exit(1);
+    }
+    if (fseek(inf, 0, SEEK_END) != 0 || (originalsize = ftell(inf)) < 0) {
+      fprintf(stderr, "input_file must be a regular file with -d\n");
+      exit(1);
+    }
+    fclose(inf);
+  }
+}
+
 /*
  * main function
  *
@@ -86,25 +687,238 @@ void writebinfile()
  *   2. make huffman tree
  *   3. make huffman code
  *   4. write encoded bin file
+ *
+ * With canonical huffman code, frequencies are counted but not saved.
+ * The code is changed to canonical code after step 3, and code length
+ * file is written instead of frequency file.
+ *
+ * With -1, steps 1~3 are done for each block while writing bin file,
+ * and code length file is written last, when original size is known.
+ * With -k, code lengths are saved in the header of bin file instead.
+ * With -g, steps 2~3 make the codes of table set by make_tableset().
+ * With -w, steps 1~3 count all input files and write the dictionary.
+ * With -d, steps 1~3 are reading the dictionary instead.
+ * With -p, steps 1~3 are done for each block while writing stream.
+ * With -a, all steps are done for each file by run_batch().
+ *
+ * With --stats, each step is timed as its phase, and stats are written
+ * at the end.
  */
 int main(int argc, char *argv[])
 {
+  static struct option longopts[] = {
+    { "stats", optional_argument, NULL, 'S' },
+    { NULL, 0, NULL, 0 }
+  };
+  stats_struct statsdata;
+  FILE *statsf = stderr;  // stdout may be the stream
+  char *dictfilename = NULL;  // dictionary, with -w or -d
+  char *listfilename = NULL;  // list of input files, with -a
+  char **files;
+  int opt, training = 0, batch = 0, nfiles;
+  while ((opt = getopt_long(argc, argv, "ac1kmpl:s:t:b:g:q:w:d:f:", longopts, NULL)) != -1) {
+    switch (opt) {
+    case 'S':  // time and counters of phases
+      stats_init(&statsdata, 0);
+      stats = &statsdata;
+      if (optarg != NULL && (statsf = fopen(optarg, "w")) == NULL) {
+        file_error(optarg);
+        return 1;
+      }
+      break;
+    case 'c':  // canonical huffman code
+      canonical = 1;
+      break;
+    case 'k':  // container file
+      canonical = 1;
+      container = 1;
+      break;
+    case 'm':  // map input file to memory
+      usemmap = 1;
+      break;
+    case 'p':  // stream mode
+      canonical = 1;
+      streaming = 1;
+      break;
+    case 'a':  // batch mode
+      canonical = 1;
+      batch = 1;
+      break;
+    case 'f':  // list of input files
+      listfilename = optarg;
+      break;
+    case '1':  // read input file once, code of each block
+      canonical = 1;
+      blocktables = 1;
+      break;
+    case 'l':  // maximum code length
+      maxbits = atoi(optarg);
+      if (maxbits < MIN_MAXBITS || maxbits > MAX_CODELEN) {
+        fprintf(stderr, "maxbits must be %d to %d\n", MIN_MAXBITS, MAX_CODELEN);
+        return 1;
+      }
+      break;
+    case 's':  // number of interleaved streams
+      nstreams = atoi(optarg);
+      if (nstreams != 1 && nstreams != 2 && nstreams != 4 && nstreams != 8) {
+        fprintf(stderr, "nstreams must be 1, 2, 4 or 8\n");
+        return 1;
+      }
+      break;
+    case 't':  // number of threads
+      nthreads = atoi(optarg);
+      if (nthreads < 1 || nthreads > MAX_THREADS) {
+        fprintf(stderr, "nthreads must be 1 to %d\n", MAX_THREADS);
+        return 1;
+      }
+      break;
+    case 'b':  // block size in Kilo Bytes
+      blocksize = atoi(optarg) * 1024;
+      if (blocksize < MIN_BLOCKSIZE || blocksize > MAX_BLOCKSIZE || (blocksize & (blocksize-1)) != 0) {
+        fprintf(stderr, "blocksize must be power of 2, %d to %d\n", MIN_BLOCKSIZE/1024, MAX_BLOCKSIZE/1024);
+        return 1;
+      }
+      break;
+    case 'w':  // train dictionary
+      training = 1;
+      // fall through
+    case 'd':  // encode by dictionary
+      canonical = 1;
+      dictionary = 1;
+      dictfilename = optarg;
+      break;
+    case 'g':  // table set
+      canonical = 1;
+      ntables = atoi(optarg);
+      if (ntables < 2 || ntables > MAX_TABLES) {
+        fprintf(stderr, "ntables must be 2 to %d\n", MAX_TABLES);
+        return 1;
+      }
+      break;
+    case 'q':  // pipeline with buffers
+      iosize = DEF_IOSIZE / 1024;
+      if (sscanf(optarg, "%d,%d", &nbuffers, &iosize) < 1 || nbuffers < 1 || nbuffers > MAX_BUFFERS ||
+          iosize < 4 || iosize > MAX_BLOCKSIZE / 1024) {
+        fprintf(stderr, "nbuffers must be 1 to %d, bufsize %d to %d\n", MAX_BUFFERS, 4, MAX_BLOCKSIZE/1024);
+        return 1;
+      }
+      iosize *= 1024;
+      break;
+    default:
+      fprintf(stderr, "Usage: huffenc [-c1kmp] [-l maxbits] [-s nstreams] [-t nthreads] [-b blocksize]\n"
+              "               [-g ntables] [-q nbuffers[,bufsize]] [--stats[=stats_file]] [input_file] [bin_file] [frq_file]\n"
+              "       huffenc -w dict_file [-l maxbits] [-t nthreads] [input_file]...\n"
+              "       huffenc -d dict_file [-m] [-q nbuffers[,bufsize]] [--stats[=stats_file]] [input_file] [bin_file]\n"
+              "       huffenc -a [-l maxbits] [-s nstreams] [-t nthreads] [-b blocksize] [-f list_file] [input_file]...\n");
+      return 1;
+    }
+  }
+  argc -= optind - 1;  // arguments after options are file names
+  argv += optind - 1;
+
+  if (listfilename != NULL && !batch) {
+    fprintf(stderr, "-f can be used only with -a\n");
+    return 1;
+  }
+  if (batch) {  // many files, each to its own stream
+    if (blocktables || container || streaming || ntables != 0 || usemmap || nbuffers != 0 || dictionary ||
+        stats != NULL) {
+      fprintf(stderr, "-a can't be used with -1, -k, -p, -g, -m, -q, -w, -d or --stats\n");
+      return 1;
+    }
+    if (maxbits > LENFILE_MAXBITS) {
+      fprintf(stderr, "maxbits must be up to %d with canonical code\n", LENFILE_MAXBITS);
+      return 1;
+    }
+    files = read_filelist(listfilename, argv+1, argc-1, &nfiles);
+    return (run_batch(files, nfiles, 0, nthreads, maxbits, nstreams, blocksize) != 0);
+  }
   if (argc < 2)
-    strcpy(infilename,DEF_INFILE);
+    strcpy(infilename, streaming ? "-" : DEF_INFILE);
   else
     strcpy(infilename,argv[1]);
   if (argc < 3)
-    strcpy(binfilename,DEF_BINFILE);
+    strcpy(binfilename, streaming ? "-" : DEF_BINFILE);
   else
     strcpy(binfilename,argv[2]);
   if (argc < 4)
     strcpy(frqfilename,DEF_FRQFILE);
   else
     strcpy(frqfilename,argv[3]);
+  if (dictfilename != NULL) {  // dictionary instead of frq_file
+    if (blocktables || container || streaming || ntables != 0 || nstreams > 1 || blocksize != 0) {
+      fprintf(stderr, "-w and -d can't be used with -1, -k, -p, -g, -s or -b\n");
+      return 1;
+    }
+    strcpy(frqfilename, dictfilename);
+  }
 
-  make_frqfile();       // make frequency file
-  make_hufftree();      // make huffman tree
-  make_huffcode(root);  // make huffman code
-  writebinfile();       // write encoded bin file
+  stats_phase(stats, PHASE_IO);
+  if (usemmap && !streaming && !training) inmap = map_infile(infilename, &inmapsize);  // NULL if can't map
+  if (ntables != 0 && (blocktables || streaming)) {
+    fprintf(stderr, "-g can't be used with -1 or -p\n");
+    return 1;
+  }
+  if ((nstreams > 1 || nthreads > 1 || blocktables || streaming || ntables != 0) && blocksize == 0 &&
+      !dictionary)  // blocked bin file
+    blocksize = DEF_BLOCKSIZE;
+  if (canonical) {
+    if (maxbits > LENFILE_MAXBITS) {
+      fprintf(stderr, "maxbits must be up to %d with canonical code\n", LENFILE_MAXBITS);
+      return 1;
+    }
+    if (maxbits == 0) maxbits = LENFILE_MAXBITS;
+  }
+  if (training)
+    make_dictionary(argv+1, argc-1);  // all arguments are input files
+  else if (dictionary) {
+    stats_phase(stats, PHASE_CODE);
+    read_dictionary();      // read dictionary, no frequency counted
+    stats_phase(stats, PHASE_IO);
+    writebinfile();         // write encoded bin file
+  }
+  else if (streaming)
+    writestream();          // write stream with codes of blocks
+  else if (blocktables) {
+    writebinfile_blocks();  // write encoded blocks with their codes
+    if (!container) make_lenfile();  // make code length file
+  }
+  else {
+    stats_phase(stats, PHASE_HISTOGRAM);
+    if (canonical) {
+      count_frq();          // count frequency
+      if (ntables != 0) {
+        stats_phase(stats, PHASE_CODE);
+        make_tableset();    // make codes of table set, 0 tables if one block
+      }
+      if (ntables == 0) {
+        stats_phase(stats, PHASE_TREE);
+        make_hufftree();      // make huffman tree
+        stats_phase(stats, PHASE_CODE);
+        make_huffcode(root);  // make huffman code
+        make_canonical(&filecode);  // change to canonical code
+      }
+      stats_phase(stats, PHASE_IO);
+      if (!container) make_lenfile();  // make code length file
+    }
+    else {
+      make_frqfile();       // make frequency file
+      stats_phase(stats, PHASE_TREE);
+      make_hufftree();      // make huffman tree
+      stats_phase(stats, PHASE_CODE);
+      make_huffcode(root);  // make huffman code
+    }
+    if (blocksize != 0)
+      writebinfile_blocks();  // write encoded blocked bin file
+    else
+      writebinfile();       // write encoded bin file
+  }
+  if (inmap != NULL) unmap_file(inmap, inmapsize);
+  if (stats != NULL) {
+    stats->bytesin = originalsize;
+    stats->bytesout = encodedsize;
+    stats_print(stats, statsf, "huffenc");
+    if (statsf != stderr) fclose(statsf);
+  }
   return 0;
 }
@@ -0,0 +1,1115 @@
+/*
+ * hufflib.c
+ *
+ * hufflib.c offers huffman coding of memory buffers, for programs
+ * which code many small messages and can't run huffenc for each.
+ *
+ * Encoding a buffer:
+ *      huff_pointer hp = huff_new(0, 0, 0);  // default options
+ *      size = huff_encode(hp, src, len, dst, huff_bound(hp, len));
+ * Decoding it:
+ *      len = huff_decode(hp, dst, size, src, huff_decoded_size(dst, size));
+ * Or only n characters from offset of it:
+ *      n = huff_decode_range(hp, dst, size, offset, src, n);
+ *      huff_free(hp);
+ *
+ * Many small inputs, which are alike, are coded by a dictionary made
+ * from them once, with no code saved in each and no counting:
+ *      n = huff_make_dict(counts, total, 0, dict);  // counts of the inputs
+ *      huff_pointer hp = huff_load_dict(dict, n);
+ *      size = huff_dict_encode(hp, src, len, dst, DICT_BOUND(len));
+ *      len = huff_dict_decode(hp, dst, size, src, huff_dict_size(dst, size));
+ *
+ * A stream which arrives in pieces, such as from a socket, is decoded
+ * as they arrive, with no allocation and no blocking for each piece:
+ *      huff_feed_pointer f = huff_feed_new(0, 0, 0, 0);
+ *      n = huff_feed(f, piece, len, &used, out, cap);  // for each piece
+ *      n = huff_feed_end(f, out, cap);  // until 0
+ *      huff_feed_free(f);
+ * Encoding is the same, with huff_feed_new(1, maxbits, nstreams, blocksize).
+ *
+ * Time of each phase and counters of coding are added to a stats_struct
+ * set by huff_set_stats(), for programs which watch how well and how
+ * fast their data is coded.
+ *
+ * Every block of the stream gets its own canonical code, or uses the
+ * code of the block before, like "huffenc -p". Only functions of
+ * huff.c which use no global variable are called, so one huff_struct
+ * for each thread is enough to code on threads.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hufflib.h"
+
+/*
+ * function huff_new
+ *
+ * Make new state for coding. Arguments are options of encoding, 0 for
+ * default. Decoding takes options from the stream instead.
+ *
+ * Arguments:
+ *      int maxbits - maximum code length, 8 to 15, default 15.
+ *      int nstreams - number of interleaved streams, 1, 2, 4 or 8,
+ *          default 1.
+ *      int blocksize - characters in one block, power of 2 from
+ *          MIN_BLOCKSIZE to MAX_BLOCKSIZE, default DEF_BLOCKSIZE.
+ *
+ * Returns:
+ *      New state, or NULL if an option is wrong or out of memory.
+ */
+huff_pointer huff_new(int maxbits, int nstreams, int blocksize)
+{
+  huff_pointer hp;
+  if (maxbits == 0) maxbits = LENFILE_MAXBITS;
+  if (nstreams == 0) nstreams = 1;
+  if (blocksize == 0) blocksize = DEF_BLOCKSIZE;
+  if (maxbits < MIN_MAXBITS || maxbits > LENFILE_MAXBITS ||
+      (nstreams != 1 && nstreams != 2 && nstreams != 4 && nstreams != 8) ||
+      blocksize < MIN_BLOCKSIZE || blocksize > MAX_BLOCKSIZE || (blocksize & (blocksize-1)) != 0)
+    return NULL;
+  hp = calloc(1, sizeof(huff_struct));
+  if (hp == NULL) return NULL;
+  hp->opt.maxbits = maxbits;
+  hp->opt.nstreams = nstreams;
+  hp->opt.blocksize = blocksize;
+  return hp;
+}
+
+/*
+ * function huff_free
+ *
+ * Free state made by huff_new().
+ */
+void huff_free(huff_pointer hp)
+{
+  free_dectable(&hp->table);
+  free(hp);
+}
+
+/*
+ * function huff_set_stats
+ *
+ * Add time and counters of coding by hp to s from now on, or stop with
+ * NULL. s must be cleared by stats_init() first. CPU time is of the
+ * calling thread, so each thread can have its own stats_struct. s is
+ * not locked, so one s must not be shared by threads.
+ */
+void huff_set_stats(huff_pointer hp, stats_pointer s)
+{
+  hp->stats = s;
+  if (s != NULL) s->threadclock = 1;
+}
+
+/*
+ * function huff_bound
+ *
+ * Returns:
+ *      Maximum size of len characters encoded by huff_encode().
+ */
+long long huff_bound(huff_pointer hp, long long len)
+{
+  long long nblocks = (len + hp->opt.blocksize - 1) / hp->opt.blocksize;
+  return 5 + OPTIONS_MAXSIZE + nblocks * STREAM_BLOCK_BOUND(0) + 2*len + BLOCKHEAD_SIZE;
+}
+
+/*
+ * function huff_put_header
+ *
+ * Save the header of stream: STREAM_MAGIC, size of options and options
+ * of hp. The code of the block before is forgotten, so hp can encode
+ * a new stream.
+ *
+ * Returns:
+ *      Number of bytes saved to out, up to 5+OPTIONS_MAXSIZE.
+ */
+int huff_put_header(huff_pointer hp, unsigned char *out)
+{
+  hp->gen = 0;
+  memcpy(out, STREAM_MAGIC, 4);
+  out[4] = put_options(&hp->opt, out+5);
+  return 5 + out[4];
+}
+
+/*
+ * function huff_get_header
+ *
+ * Read the header of stream which huff_put_header() saved, and set
+ * options of hp. The code of the block before is forgotten.
+ *
+ * Returns:
+ *      Number of bytes read, or -1 if in is not a stream.
+ */
+int huff_get_header(huff_pointer hp, unsigned char *in, int len)
+{
+  if (len < 5 || memcmp(in, STREAM_MAGIC, 4) != 0 || 5 + in[4] > len ||
+      get_options(in+5, in[4], &hp->opt) >= 0 || hp->opt.ntables != 0)  // no table set in stream
+    return -1;
+  if (hp->opt.blocksize == 0) hp->opt.blocksize = DEF_BLOCKSIZE;
+  hp->gen = 0;
+  hp->tablegen = 0;
+  return 5 + in[4];
+}
+
+/*
+ * function huff_count_block
+ *
+ * Count frequencies of one block, and make its own canonical code.
+ * Blocks can be counted on threads, each with its own hp.
+ */
+void huff_count_block(huff_pointer hp, unsigned char *in, int insize)
+{
+  stats_phase(hp->stats, PHASE_HISTOGRAM);
+  memset(hp->counts, 0, sizeof(hp->counts));
+  count_bytes(in, insize, hp->counts);
+  stats_phase(hp->stats, PHASE_CODE);
+  make_blockcode(hp->counts, &hp->own, hp->opt.maxbits);
+  stats_phase(hp->stats, PHASE_NONE);
+}
+
+/*
+ * function huff_choose_code
+ *
+ * Choose the code of the block counted by huff_count_block(). If the
+ * code of the block before, in prev, encodes the block to bits not
+ * more than its own code and code lengths, the code before is used
+ * and kind is 'R'. Otherwise its own code is used and kind is 'C'.
+ * prev may be hp itself. Blocks must be chosen in order, as each
+ * depends on the block before.
+ *
+ * If block_kind() finds that the block has one character, kind is 'F',
+ * or that coding doesn't make it smaller, kind is 'S'. Such a block is
+ * not coded, so the code before is kept for the next block.
+ */
+void huff_choose_code(huff_pointer hp, huff_pointer prev)
+{
+  long long own, last = -1, size = 0;
+  int i, n = 0;
+
+  stats_phase(hp->stats, PHASE_CODE);
+  for (i=0; i<256; i++) {
+    if (hp->own.bitlength[i] != 0) n++;
+    size += hp->counts[i];
+  }
+  own = code_bits(hp->counts, &hp->own) + 8 * (32 + (n+1)/2);  // with code lengths
+  if (prev->gen != 0) last = code_bits(hp->counts, &prev->code);
+  switch (block_kind(hp->counts, size, (last >= 0 && last <= own ? last : own) + 8 * 4*hp->opt.nstreams)) {
+  case BLOCK_RUN:
+    hp->kind = 'F';
+    break;
+  case BLOCK_STORED:
+    hp->kind = 'S';
+    break;
+  default:
+    hp->kind = (last >= 0 && last <= own ? 'R' : 'C');
+  }
+  if (hp->kind == 'C') {
+    hp->code = hp->own;
+    hp->gen = prev->gen + 1;
+  }
+  else {  // use or keep the code before
+    if (prev != hp) hp->code = prev->code;
+    hp->gen = prev->gen;
+  }
+  stats_phase(hp->stats, PHASE_NONE);
+}
+
+/*
+ * function huff_write_block
+ *
+ * Encode one block by the code huff_choose_code() chose, with block
+ * header and code lengths for 'C'. A block of kind 'S' is copied, and
+ * of kind 'F' saves its character only. Blocks can be written on
+ * threads, each with its own hp.
+ *
+ * Arguments:
+ *      unsigned char *out - STREAM_BLOCK_BOUND(insize) bytes.
+ *
+ * Returns:
+ *      Number of bytes written to out.
+ */
+int huff_write_block(huff_pointer hp, unsigned char *in, int insize, unsigned char *out)
+{
+  int o = BLOCKHEAD_SIZE, size;
+  stats_phase(hp->stats, PHASE_CODING);
+  if (hp->kind == 'S') {
+    memcpy(out+o, in, insize);
+    o += insize;
+  }
+  else if (hp->kind == 'F')
+    out[o++] = in[0];
+  else {
+    if (hp->kind == 'C') o += put_lengths(&hp->code, out+o);
+    o += encode_streams(&hp->code, hp->opt.nstreams, in, insize, out+o);
+  }
+  stats_phase(hp->stats, PHASE_NONE);
+  if (hp->stats != NULL) {
+    if (hp->kind == 'S' || hp->kind == 'F') stats_stored(hp->stats, in, insize, 8 * (o - BLOCKHEAD_SIZE));
+    else stats_code(hp->stats, hp->counts, &hp->code);
+    hp->stats->bytesin += insize;
+    hp->stats->bytesout += o;
+  }
+  size = o - BLOCKHEAD_SIZE;
+  out[0] = hp->kind;
+  out[1] = insize;
+  out[2] = insize >> 8;
+  out[3] = insize >> 16;
+  out[4] = insize >> 24;
+  out[5] = size;
+  out[6] = size >> 8;
+  out[7] = size >> 16;
+  out[8] = size >> 24;
+  return o;
+}
+
+/*
+ * function huff_put_end
+ *
+ * Save the end of stream, kind 'E' with sizes 0.
+ *
+ * Returns:
+ *      Number of bytes saved, BLOCKHEAD_SIZE.
+ */
+int huff_put_end(unsigned char *out)
+{
+  memset(out, 0, BLOCKHEAD_SIZE);
+  out[0] = 'E';
+  return BLOCKHEAD_SIZE;
+}
+
+/*
+ * function huff_encode
+ *
+ * Encode len characters of src to dst as one stream.
+ *
+ * Returns:
+ *      Size of the stream, or -1 if cap is less than huff_bound().
+ */
+long long huff_encode(huff_pointer hp, unsigned char *src, long long len, unsigned char *dst, long long cap)
+{
+  long long i, o;
+  int n;
+  if (cap < huff_bound(hp, len)) return -1;
+  o = huff_put_header(hp, dst);
+  if (hp->stats != NULL) hp->stats->bytesout += o + BLOCKHEAD_SIZE;  // header and end
+  for (i=0; i<len; i+=n) {  // for each block
+    n = (len - i < hp->opt.blocksize ? len - i : hp->opt.blocksize);
+    huff_count_block(hp, src+i, n);
+    huff_choose_code(hp, hp);
+    o += huff_write_block(hp, src+i, n, dst+o);
+  }
+  return o + huff_put_end(dst+o);
+}
+
+/*
+ * function huff_block_size
+ *
+ * Returns:
+ *      Size of the block whose BLOCKHEAD_SIZE bytes header is in, with
+ *      the header, or -1 if too big to be a block.
+ */
+int huff_block_size(unsigned char *in)
+{
+  unsigned int size = in[5] | in[6] << 8 | in[7] << 16 | (unsigned int)in[8] << 24;
+  if (size > STREAM_BLOCK_BOUND(MAX_BLOCKSIZE) - BLOCKHEAD_SIZE) return -1;
+  return BLOCKHEAD_SIZE + size;
+}
+
+/*
+ * function huff_block_chars
+ *
+ * Returns:
+ *      Characters of the block whose BLOCKHEAD_SIZE bytes header is in,
+ *      or -1 if more than a block can have.
+ */
+int huff_block_chars(unsigned char *in)
+{
+  unsigned int chars = in[1] | in[2] << 8 | in[3] << 16 | (unsigned int)in[4] << 24;
+  if (chars > MAX_BLOCKSIZE) return -1;
+  return chars;
+}
+
+/*
+ * function huff_read_block
+ *
+ * Read the header and the code of one block at in, and check it. Kind
+ * 'E' is the end of stream. Blocks must be read in order, as a block
+ * of kind 'R' takes the code of the block before from prev, which may
+ * be hp itself.
+ *
+ * Arguments:
+ *      unsigned char *in, int len - the block. 8 more readable bytes
+ *          must follow the block, for huff_decode_block().
+ *
+ * Returns:
+ *      Size of the block, or -1 if broken.
+ */
+int huff_read_block(huff_pointer hp, unsigned char *in, int len, huff_pointer prev)
+{
+  int size;
+  if (len < BLOCKHEAD_SIZE) return -1;
+  hp->kind = in[0];
+  hp->chars = huff_block_chars(in);
+  size = huff_block_size(in);
+  if (hp->stats != NULL) {
+    hp->stats->decode = 1;
+    hp->stats->bytesin += (hp->kind == 'E' ? BLOCKHEAD_SIZE : size);
+  }
+  if (hp->kind == 'E') return BLOCKHEAD_SIZE;
+  if (size < 0 || size + 8 > len || hp->chars <= 0 || hp->chars > hp->opt.blocksize) return -1;
+  in += BLOCKHEAD_SIZE;
+  size -= BLOCKHEAD_SIZE;
+  hp->lensize = 0;
+  if (hp->kind == 'S' || hp->kind == 'F') {  // not coded, the code before is kept
+    if (size != (hp->kind == 'S' ? hp->chars : 1)) return -1;
+    if (prev != hp) hp->code = prev->code;
+    hp->gen = prev->gen;
+    return BLOCKHEAD_SIZE + size;
+  }
+  if (hp->kind == 'C') {  // its own code
+    hp->lensize = get_lengths(in, size, &hp->code);
+    if (hp->lensize < 0) return -1;
+    hp->gen = prev->gen + 1;
+  }
+  else if (hp->kind == 'R' && prev->gen != 0) {  // the code before
+    if (prev != hp) hp->code = prev->code;
+    hp->gen = prev->gen;
+  }
+  else return -1;
+  if (!check_streams(in + hp->lensize, size - hp->lensize, hp->opt.nstreams)) return -1;
+  return BLOCKHEAD_SIZE + size;
+}
+
+/*
+ * function huff_decode_block
+ *
+ * Decode one block which huff_read_block() read, to hp->chars
+ * characters of out. The decoding table is made only when the code is
+ * not the one it was made for. Blocks of kind 'S' and 'F' are copied
+ * and filled instead. Blocks can be decoded on threads, each
+ * with its own hp.
+ *
+ * With stats, decoded characters are counted too, as their frequencies
+ * are not in the stream.
+ *
+ * Returns:
+ *      0, or -1 if codes run over the end of a stream of the block.
+ */
+int huff_decode_block(huff_pointer hp, unsigned char *in, unsigned char *out)
+{
+  if (hp->kind == 'S' || hp->kind == 'F') {
+    stats_phase(hp->stats, PHASE_CODING);
+    if (hp->kind == 'S') memcpy(out, in + BLOCKHEAD_SIZE, hp->chars);
+    else memset(out, in[BLOCKHEAD_SIZE], hp->chars);
+    if (hp->stats != NULL) {
+      stats_phase(hp->stats, PHASE_HISTOGRAM);
+      stats_stored(hp->stats, out, hp->chars, 8 * (hp->kind == 'S' ? hp->chars : 1));
+      hp->stats->bytesout += hp->chars;
+    }
+    stats_phase(hp->stats, PHASE_NONE);
+    return 0;
+  }
+  if (hp->tablegen != hp->gen) {  // not made for this code yet
+    stats_phase(hp->stats, PHASE_CODE);
+    make_canonical(&hp->code);
+    make_dectable(&hp->table, &hp->code, hp->chars);
+    hp->tablegen = hp->gen;
+  }
+  stats_phase(hp->stats, PHASE_CODING);
+  if (!decode_streams(&hp->table, hp->opt.nstreams, in + BLOCKHEAD_SIZE + hp->lensize, out, hp->chars)) {
+    stats_phase(hp->stats, PHASE_NONE);
+    return -1;
+  }
+  if (hp->stats != NULL) {
+    stats_phase(hp->stats, PHASE_HISTOGRAM);
+    stats_count(hp->stats, out, hp->chars, &hp->code);
+    stats_phase(hp->stats, PHASE_NONE);
+    hp->stats->bytesout += hp->chars;
+  }
+  return 0;
+}
+
+/*
+ * function huff_decoded_size
+ *
+ * Returns:
+ *      Number of characters in the stream, from block headers, or -1
+ *      if the stream is broken.
+ */
+long long huff_decoded_size(unsigned char *src, long long len)
+{
+  long long o, chars = 0;
+  int size;
+  if (len < 5 || memcmp(src, STREAM_MAGIC, 4) != 0) return -1;
+  for (o = 5 + src[4]; o + BLOCKHEAD_SIZE <= len; o += size) {
+    if (src[o] == 'E') return chars;
+    size = huff_block_size(src+o);
+    if (size < 0 || huff_block_chars(src+o) < 0) return -1;
+    chars += huff_block_chars(src+o);
+  }
+  return -1;
+}
+
+/*
+ * function huff_decode
+ *
+ * Decode the stream which huff_encode() encoded, len bytes of src, to
+ * dst.
+ *
+ * Returns:
+ *      Number of characters decoded, or -1 if the stream is broken or
+ *      longer than cap.
+ */
+long long huff_decode(huff_pointer hp, unsigned char *src, long long len, unsigned char *dst, long long cap)
+{
+  long long i, o = 0;
+  int n;
+  i = huff_get_header(hp, src, (len < 5 + 255 ? len : 5 + 255));  // options take up to 255 bytes
+  if (i < 0) return -1;
+  if (hp->stats != NULL) hp->stats->bytesin += i;
+  for (;;) {
+    n = huff_read_block(hp, src+i, (len-i < STREAM_BLOCK_BOUND(MAX_BLOCKSIZE) + 8 ?
+                                    len-i : STREAM_BLOCK_BOUND(MAX_BLOCKSIZE) + 8), hp);
+    if (n < 0) return -1;
+    if (hp->kind == 'E') return o;
+    if (hp->chars > cap - o || huff_decode_block(hp, src+i, dst+o) < 0) return -1;
+    o += hp->chars;
+    i += n;
+  }
+}
+
+/*
+ * function huff_decode_range
+ *
+ * Decode only characters offset to offset+cap of the stream which
+ * huff_encode() encoded, len bytes of src, to dst. Each block can be
+ * decoded alone, so blocks before offset are read for their codes but
+ * not decoded, and blocks after the range are not read. A block partly
+ * in the range is decoded to a buffer of one block.
+ *
+ * Returns:
+ *      Number of characters decoded, less than cap if the stream ends
+ *      before, or -1 if the stream is broken or out of memory.
+ */
+long long huff_decode_range(huff_pointer hp, unsigned char *src, long long len, long long offset,
+                            unsigned char *dst, long long cap)
+{
+  unsigned char *tmp = NULL;
+  long long i, o = 0, pos = 0, start, end;
+  int n;
+  i = huff_get_header(hp, src, (len < 5 + 255 ? len : 5 + 255));
+  if (i < 0) return -1;
+  if (hp->stats != NULL) hp->stats->bytesin += i;
+  while (o < cap) {
+    n = huff_read_block(hp, src+i, (len-i < STREAM_BLOCK_BOUND(MAX_BLOCKSIZE) + 8 ?
+                                    len-i : STREAM_BLOCK_BOUND(MAX_BLOCKSIZE) + 8), hp);
+    if (n < 0) {
+      o = -1;
+      break;
+    }
+    if (hp->kind == 'E') break;
+    if (pos + hp->chars > offset) {  // in the range
+      start = (offset > pos ? offset - pos : 0);
+      end = (offset + cap - pos < hp->chars ? offset + cap - pos : hp->chars);
+      if (start == 0 && end == hp->chars) {  // the whole block
+        if (huff_decode_block(hp, src+i, dst+o) < 0) {
+          o = -1;
+          break;
+        }
+      }
+      else {
+        if (tmp == NULL) tmp = malloc(hp->opt.blocksize);
+        if (tmp == NULL || huff_decode_block(hp, src+i, tmp) < 0) {
+          o = -1;
+          break;
+        }
+        memcpy(dst+o, tmp+start, end-start);
+      }
+      o += end - start;
+    }
+    pos += hp->chars;
+    i += n;
+  }
+  free(tmp);
+  return o;
+}
+
+/* Parts of the stream huff_feed() reads next when decoding */
+#define FEED_HEADER 0     // magic and size of options
+#define FEED_OPTIONS 1    // options, which may be 0 bytes
+#define FEED_BLOCKHEAD 2  // kind, characters and size of a block
+#define FEED_STORED 3     // characters of a block of kind 'S'
+#define FEED_FILL 4       // the character of a block of kind 'F'
+#define FEED_BLOCK 5      // a block of many streams, decoded at once
+#define FEED_BITMAP 6     // which characters have codes, in a block of one stream
+#define FEED_CODE 7       // code lengths and size of a block of one stream
+#define FEED_BITS 8       // bits of a block of one stream
+#define FEED_END 9        // nothing, the end of stream was read
+
+/*
+ * function huff_feed_new
+ *
+ * Make new state for coding one stream pushed in pieces. Arguments are
+ * as huff_new(). When decoding, maxbits and nstreams are not used, and
+ * blocksize is the largest block size of streams it can decode, 0 for
+ * DEF_BLOCKSIZE, as the buffers of one block are made now.
+ *
+ * Encoding header is given out first. Decoding starts with the header.
+ *
+ * Returns:
+ *      New state, or NULL if an option is wrong or out of memory.
+ */
+huff_feed_pointer huff_feed_new(int encode, int maxbits, int nstreams, int blocksize)
+{
+  huff_feed_pointer f = calloc(1, sizeof(huff_feed_struct));
+  if (f == NULL) return NULL;
+  f->encode = encode;
+  f->hp = huff_new((encode ? maxbits : 0), (encode ? nstreams : 0), blocksize);
+  if (f->hp == NULL) {
+    free(f);
+    return NULL;
+  }
+  f->maxblock = f->hp->opt.blocksize;
+  if (encode) {
+    f->buf = malloc(f->maxblock);
+    f->out = malloc(STREAM_BLOCK_BOUND(f->maxblock));
+  }
+  else {
+    f->buf = malloc(STREAM_BLOCK_BOUND(f->maxblock) + 8);
+    f->out = malloc(f->maxblock);
+  }
+  if (f->buf == NULL || f->out == NULL) {
+    huff_feed_free(f);
+    return NULL;
+  }
+  if (encode) f->outlen = huff_put_header(f->hp, f->out);
+  else {
+    f->state = FEED_HEADER;
+    f->need = 5;
+  }
+  return f;
+}
+
+/*
+ * function huff_feed_free
+ *
+ * Free state made by huff_feed_new().
+ */
+void huff_feed_free(huff_feed_pointer f)
+{
+  huff_free(f->hp);
+  free(f->buf);
+  free(f->out);
+  free(f);
+}
+
+/*
+ * function give_out
+ *
+ * Copy bytes coded but not given yet to out, as many as room allows.
+ *
+ * Returns:
+ *      Number of bytes copied to out.
+ */
+static long long give_out(huff_feed_pointer f, unsigned char *out, long long cap)
+{
+  long long n = f->outlen - f->outpos;
+  if (n > cap) n = cap;
+  memcpy(out, f->out + f->outpos, n);
+  f->outpos += n;
+  return n;
+}
+
+/*
+ * function gather
+ *
+ * Copy bytes from in, from *i, to buf, until it has f->need bytes.
+ *
+ * Returns:
+ *      1 if buf has f->need bytes, 0 if in ran out first.
+ */
+static int gather(huff_feed_pointer f, unsigned char *in, long long len, long long *i)
+{
+  long long n = f->need - f->have;
+  if (n > len - *i) n = len - *i;
+  memcpy(f->buf + f->have, in + *i, n);
+  f->have += n;
+  *i += n;
+  return f->have == f->need;
+}
+
+/*
+ * function feed_block
+ *
+ * Encode one block of insize characters to the bytes to give out.
+ */
+static void feed_block(huff_feed_pointer f, unsigned char *in, int insize)
+{
+  huff_count_block(f->hp, in, insize);
+  huff_choose_code(f->hp, f->hp);
+  f->outlen = huff_write_block(f->hp, in, insize, f->out);
+  f->outpos = 0;
+}
+
+/*
+ * function feed_blockhead
+ *
+ * Check the block header gathered in buf, and choose how to read the
+ * rest of the block. A coded block of one stream is decoded as its
+ * bits arrive, after its code lengths and stream size are gathered.
+ * Blocks of many streams take their characters from each stream in
+ * turn, so they are gathered whole and decoded by huff_decode_block().
+ *
+ * Returns:
+ *      0, or -1 if broken.
+ */
+static int feed_blockhead(huff_feed_pointer f)
+{
+  huff_pointer hp = f->hp;
+  unsigned char *in = f->buf;
+  int size = huff_block_size(in);
+
+  hp->kind = in[0];
+  hp->chars = huff_block_chars(in);
+  if (hp->kind == 'E') {
+    f->state = FEED_END;
+    return 0;
+  }
+  if (size < 0 || size > STREAM_BLOCK_BOUND(hp->opt.blocksize) || hp->chars <= 0 ||
+      hp->chars > hp->opt.blocksize)
+    return -1;
+  size -= BLOCKHEAD_SIZE;
+  f->left = hp->chars;
+  f->bytesleft = size;
+  switch (hp->kind) {
+  case 'S':
+    if (size != hp->chars) return -1;
+    f->state = FEED_STORED;
+    return 0;
+  case 'F':
+    if (size != 1) return -1;
+    f->state = FEED_FILL;
+    f->need = BLOCKHEAD_SIZE + 1;
+    return 0;
+  case 'C':
+  case 'R':
+    if (hp->opt.nstreams > 1) {
+      f->state = FEED_BLOCK;
+      f->need = BLOCKHEAD_SIZE + size;
+      return 0;
+    }
+    f->state = (hp->kind == 'C' ? FEED_BITMAP : FEED_CODE);
+    f->need = BLOCKHEAD_SIZE + (hp->kind == 'C' ? 32 : 4);  // bitmap of lengths, or stream size
+    return (f->need > BLOCKHEAD_SIZE + size ? -1 : 0);
+  }
+  return -1;
+}
+
+/*
+ * function feed_bitmap
+ *
+ * Find the size of code lengths of a block of one stream from their
+ * bitmap gathered in buf, to gather them and the stream size next.
+ *
+ * Returns:
+ *      0, or -1 if broken.
+ */
+static int feed_bitmap(huff_feed_pointer f)
+{
+  int i, n = 0;
+  for (i=0; i<256; i++)  // each appeared character has 4 bits of length
+    if (f->buf[BLOCKHEAD_SIZE + i/8] & (0x80 >> (i%8))) n++;
+  f->need = BLOCKHEAD_SIZE + 32 + (n+1)/2 + 4;
+  f->state = FEED_CODE;
+  return (f->need > BLOCKHEAD_SIZE + f->bytesleft ? -1 : 0);
+}
+
+/*
+ * function feed_code
+ *
+ * Take the code of a block of one stream, and start decoding its bits.
+ *
+ * Returns:
+ *      0, or -1 if broken.
+ */
+static int feed_code(huff_feed_pointer f)
+{
+  huff_pointer hp = f->hp;
+  int size = f->bytesleft;
+
+  hp->lensize = 0;
+  if (hp->kind == 'C') {
+    hp->lensize = get_lengths(f->buf + BLOCKHEAD_SIZE, size, &hp->code);
+    if (hp->lensize < 0) return -1;
+    hp->gen++;
+  }
+  else if (hp->gen == 0) return -1;  // 'R' with no code before
+  if (!check_streams(f->buf + BLOCKHEAD_SIZE + hp->lensize, size - hp->lensize, 1)) return -1;
+  if (hp->tablegen != hp->gen) {
+    make_canonical(&hp->code);
+    make_dectable(&hp->table, &hp->code, hp->chars);
+    hp->tablegen = hp->gen;
+  }
+  f->bytesleft = size - hp->lensize - 4;
+  f->bits = 0;
+  f->count = 0;
+  f->state = FEED_BITS;
+  return 0;
+}
+
+/*
+ * function feed_bits
+ *
+ * Decode characters of a block of one stream from the bytes of in, as
+ * writeoutfile() of huffdec.c does, by the kernel while 8 bytes of the
+ * block are in in, and one by one after. A character is decoded only
+ * when bits of the longest code are loaded, or the block has no more
+ * bytes, so bits of a code cut by the end of in wait in f->bits for
+ * the next call.
+ *
+ * Returns:
+ *      Number of characters put to out.
+ */
+static long long feed_bits(huff_feed_pointer f, unsigned char *in, long long len, long long *i,
+                           unsigned char *out, long long cap)
+{
+  dectable_pointer t = &f->hp->table;
+  dentry_pointer e;
+  long long o = 0, n, used, avail;
+
+  while (f->left > 0 && o < cap) {
+    avail = (len - *i < f->bytesleft ? len - *i : f->bytesleft);
+    if (avail >= 8) {
+      n = decode_run(t, &f->bits, &f->count, in + *i, avail, &used,
+                     out + o, (cap - o < f->left ? cap - o : f->left));
+      *i += used;
+      f->bytesleft -= used;
+      o += n;
+      f->left -= n;
+      if (n != 0) continue;
+    }
+    while (f->count < t->maxlen && f->count <= 56) {  // load bytes one by one
+      if (f->bytesleft == 0) {  // end of block, pad with bit 0
+        f->count = 64;
+        break;
+      }
+      if (*i == len) return o;  // wait for the next piece
+      f->bits |= (unsigned long long)in[(*i)++] << (56 - f->count);
+      f->count += 8;
+      f->bytesleft--;
+    }
+    e = &t->entry[f->bits >> (64-DEC_TABLE_BITS)];
+    while (e->bits != 0) {  // if the code is longer than the table
+      f->bits <<= e->len;
+      f->count -= e->len;
+      e = &t->entry[e->next + (f->bits >> (64-e->bits))];
+    }
+    f->bits <<= e->len;
+    f->count -= e->len;
+    out[o++] = e->c;
+    f->left--;
+  }
+  return o;
+}
+
+/*
+ * function huff_feed
+ *
+ * Push len bytes of in to the stream, and take coded bytes to out.
+ *
+ * Encoding gathers characters until one block is full, unless in has
+ * the whole block, and gives out the encoded block. Decoding reads
+ * the stream which huff_encode() or "huffenc -p" wrote, and stops at
+ * its end, so bytes after it are not used.
+ *
+ * Arguments:
+ *      unsigned char *in, long long len - next bytes, may be 0 bytes.
+ *      long long *used - set to the number of bytes used from in.
+ *      unsigned char *out, long long cap - room for coded bytes.
+ *
+ * Returns:
+ *      Number of bytes put to out, or -1 if the stream is broken.
+ *      Input not used, or cap bytes put, means out was full, so call
+ *      again for the rest.
+ */
+long long huff_feed(huff_feed_pointer f, unsigned char *in, long long len, long long *used,
+                    unsigned char *out, long long cap)
+{
+  long long i = 0, o = 0, n;
+
+  *used = 0;
+  for (;;) {
+    o += give_out(f, out + o, cap - o);
+    if (f->outpos < f->outlen) break;  // out is full
+    if (f->encode) {
+      if (f->have == f->maxblock) {  // a full block
+        feed_block(f, f->buf, f->have);
+        f->have = 0;
+      }
+      else if (f->have == 0 && len - i >= f->maxblock) {  // a block right from in
+        feed_block(f, in + i, f->maxblock);
+        i += f->maxblock;
+      }
+      else if (i < len) {
+        f->need = f->maxblock;
+        gather(f, in, len, &i);
+      }
+      else break;
+      continue;
+    }
+    switch (f->state) {
+    case FEED_HEADER:
+      if (!gather(f, in, len, &i)) break;
+      if (f->buf[4] > OPTIONS_MAXSIZE) return -1;
+      f->state = FEED_OPTIONS;
+      f->need += f->buf[4];
+      continue;
+    case FEED_OPTIONS:
+      if (!gather(f, in, len, &i)) break;
+      if (huff_get_header(f->hp, f->buf, f->have) < 0 || f->hp->opt.blocksize > f->maxblock) return -1;
+      f->state = FEED_BLOCKHEAD;
+      f->have = 0;
+      f->need = BLOCKHEAD_SIZE;
+      continue;
+    case FEED_BLOCKHEAD:
+      if (!gather(f, in, len, &i)) break;
+      if (feed_blockhead(f) < 0) return -1;
+      continue;
+    case FEED_BITMAP:
+      if (!gather(f, in, len, &i)) break;
+      if (feed_bitmap(f) < 0) return -1;
+      continue;
+    case FEED_CODE:
+      if (!gather(f, in, len, &i)) break;
+      if (feed_code(f) < 0) return -1;
+      continue;
+    case FEED_STORED:
+      n = (len - i < cap - o ? len - i : cap - o);
+      if (n > f->left) n = f->left;
+      memcpy(out + o, in + i, n);
+      i += n;
+      o += n;
+      f->left -= n;
+      if (n == 0 && f->left != 0) break;
+      if (f->left == 0) {
+        f->state = FEED_BLOCKHEAD;
+        f->have = 0;
+        f->need = BLOCKHEAD_SIZE;
+      }
+      continue;
+    case FEED_FILL:
+      if (!gather(f, in, len, &i)) break;
+      n = (cap - o < f->left ? cap - o : f->left);
+      memset(out + o, f->buf[BLOCKHEAD_SIZE], n);
+      o += n;
+      f->left -= n;
+      if (f->left != 0) break;
+      f->state = FEED_BLOCKHEAD;
+      f->have = 0;
+      f->need = BLOCKHEAD_SIZE;
+      continue;
+    case FEED_BLOCK:
+      if (!gather(f, in, len, &i)) break;
+      memset(f->buf + f->have, 0, 8);  // readable bytes after the block
+      if (huff_read_block(f->hp, f->buf, f->have + 8, f->hp) < 0 ||
+          huff_decode_block(f->hp, f->buf, f->out) < 0)
+        return -1;
+      f->outpos = 0;
+      f->outlen = f->hp->chars;
+      f->state = FEED_BLOCKHEAD;
+      f->have = 0;
+      f->need = BLOCKHEAD_SIZE;
+      continue;
+    case FEED_BITS:
+      n = feed_bits(f, in, len, &i, out + o, cap - o);
+      o += n;
+      if (f->left == 0) {  // skip bytes not loaded
+        n = (len - i < f->bytesleft ? len - i : f->bytesleft);
+        i += n;
+        f->bytesleft -= n;
+        if (f->bytesleft == 0) {
+          f->state = FEED_BLOCKHEAD;
+          f->have = 0;
+          f->need = BLOCKHEAD_SIZE;
+          continue;
+        }
+      }
+      break;
+    }
+    break;  // FEED_END, or waiting for in or out
+  }
+  *used = i;
+  return o;
+}
+
+/*
+ * function huff_feed_end
+ *
+ * Finish the stream. Encoding gives out the last block, shorter than
+ * others, and the end of stream. Decoding gives out the rest of the
+ * last block decoded.
+ *
+ * Returns:
+ *      Number of bytes put to out, cap if out was full, so call again
+ *      until it is 0. -1 if decoding and the end of stream was not read.
+ */
+long long huff_feed_end(huff_feed_pointer f, unsigned char *out, long long cap)
+{
+  long long o = 0;
+  for (;;) {
+    o += give_out(f, out + o, cap - o);
+    if (f->outpos < f->outlen || f->state == FEED_END) break;
+    if (!f->encode) return (o != 0 ? o : -1);
+    if (f->have != 0) {  // the last block
+      feed_block(f, f->buf, f->have);
+      f->have = 0;
+    }
+    else {
+      f->outlen = huff_put_end(f->out);
+      f->outpos = 0;
+      f->state = FEED_END;
+    }
+  }
+  return o;
+}
+
+/*
+ * function huff_make_dict
+ *
+ * Make a dictionary, the same as "huffenc -w" writes, from frequencies
+ * of many inputs which are alike, such as messages of one kind.
+ * Characters which didn't appear are counted once, so any input can be
+ * encoded by the dictionary.
+ *
+ * Arguments:
+ *      long long *counts - frequencies of the inputs, such as added by
+ *          count_bytes() for each input.
+ *      long long size - number of characters counted.
+ *      int maxbits - maximum code length, 8 to 15, 0 for 15.
+ *      unsigned char *out - the dictionary, DICT_MAXSIZE bytes.
+ *
+ * Returns:
+ *      Size of the dictionary, or -1 if maxbits is wrong.
+ */
+int huff_make_dict(long long *counts, long long size, int maxbits, unsigned char *out)
+{
+  long long smooth[256];
+  options_struct o;
+  code_struct c;
+  int i, n;
+  if (maxbits == 0) maxbits = LENFILE_MAXBITS;
+  if (maxbits < MIN_MAXBITS || maxbits > LENFILE_MAXBITS) return -1;
+  for (i=0; i<256; i++) smooth[i] = (counts[i] == 0 ? 1 : counts[i]);
+  make_blockcode(smooth, &c, maxbits);
+  n = put_lenfile(&c, size, out);
+  memset(&o, 0, sizeof(o));
+  o.maxbits = maxbits;
+  o.nstreams = 1;
+  o.dictionary = 1;
+  return n + put_options(&o, out+n);
+}
+
+/*
+ * function huff_load_dict
+ *
+ * Make new state for coding many inputs by the dictionary of len bytes
+ * at dict, which huff_make_dict() made or "huffenc -w" wrote. The
+ * decoding table is made here once, so each input is coded with no
+ * counting and no table to make.
+ *
+ * Returns:
+ *      New state, or NULL if dict is not a dictionary or out of memory.
+ */
+huff_pointer huff_load_dict(unsigned char *dict, int len)
+{
+  huff_pointer hp;
+  long long size;
+  int n;
+  hp = calloc(1, sizeof(huff_struct));
+  if (hp == NULL) return NULL;
+  n = get_lenfile(dict, len, &hp->code, &size);
+  if (n <= 0 || get_options(dict+n, len-n, &hp->opt) >= 0 || !hp->opt.dictionary) {
+    free(hp);
+    return NULL;
+  }
+  make_canonical(&hp->code);
+  hp->table.generic = 1;  // decode_bits() uses no flat table
+  make_dectable(&hp->table, &hp->code, 0);
+  hp->gen = hp->tablegen = 1;
+  return hp;
+}
+
+/*
+ * function huff_dict_encode
+ *
+ * Encode len characters of src to dst by the dictionary of hp, as
+ * "huffenc -d" does: the size of src by put_varsize(), and the codes.
+ * Inputs must be up to MAX_BLOCKSIZE characters.
+ *
+ * Returns:
+ *      Size of encoded data, or -1 if src is too long or cap is less
+ *      than DICT_BOUND(len).
+ */
+long long huff_dict_encode(huff_pointer hp, unsigned char *src, long long len, unsigned char *dst, long long cap)
+{
+  packer_struct pk = { 0, 0 };
+  int o;
+  if (len > MAX_BLOCKSIZE || cap < DICT_BOUND(len)) return -1;
+  stats_phase(hp->stats, PHASE_CODING);
+  o = put_varsize(len, dst);
+  pack_codes(&pk, &hp->code, src, len, dst, &o, DICT_BOUND(len));
+  o += flush_codes(&pk, dst+o);
+  if (hp->stats != NULL) {
+    stats_phase(hp->stats, PHASE_HISTOGRAM);
+    stats_count(hp->stats, src, len, &hp->code);
+    stats_phase(hp->stats, PHASE_NONE);
+    hp->stats->bytesin += len;
+    hp->stats->bytesout += o;
+  }
+  return o;
+}
+
+/*
+ * function huff_dict_size
+ *
+ * Returns:
+ *      Number of characters encoded by huff_dict_encode() in len bytes
+ *      of src, or -1 if broken.
+ */
+long long huff_dict_size(unsigned char *src, long long len)
+{
+  long long size;
+  if (get_varsize(src, (len < VARSIZE_MAXSIZE ? len : VARSIZE_MAXSIZE), &size) < 0) return -1;
+  return size;
+}
+
+/*
+ * function huff_dict_decode
+ *
+ * Decode len bytes of src, which huff_dict_encode() encoded, to dst by
+ * the dictionary of hp. Bytes after src are not read, so src can be a
+ * message anywhere in a buffer.
+ *
+ * Returns:
+ *      Number of characters decoded, or -1 if src is broken or they
+ *      are more than cap.
+ */
+long long huff_dict_decode(huff_pointer hp, unsigned char *src, long long len, unsigned char *dst, long long cap)
+{
+  long long size;
+  int n;
+  n = get_varsize(src, (len < VARSIZE_MAXSIZE ? len : VARSIZE_MAXSIZE), &size);
+  if (n < 0 || size > cap || size > MAX_BLOCKSIZE) return -1;
+  if (len - n > DICT_BOUND(MAX_BLOCKSIZE)) len = n + DICT_BOUND(MAX_BLOCKSIZE);  // more is not read
+  stats_phase(hp->stats, PHASE_CODING);
+  if (!decode_bits(&hp->table, src+n, len-n, dst, size)) size = -1;
+  if (hp->stats != NULL && size >= 0) {
+    stats_phase(hp->stats, PHASE_HISTOGRAM);
+    stats_count(hp->stats, dst, size, &hp->code);
+    hp->stats->decode = 1;
+    hp->stats->bytesin += len;
+    hp->stats->bytesout += size;
+  }
+  stats_phase(hp->stats, PHASE_NONE);
+  return size;
+}
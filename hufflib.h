@@ -0,0 +1,110 @@
+/*
+ * hufflib.h
+ *
+ * Header file for hufflib.c
+ *
+ * hufflib.c offers huffman coding of memory buffers. All state is in a
+ * huff_struct made by huff_new(), and no global variable is used, so
+ * each thread can code with its own huff_struct at the same time.
+ *
+ * Encoded data is the stream which "huffenc -p" writes, so it can be
+ * decoded by "huffdec -p" too.
+ */
+
+#include "huff.h"
+#include "stats.h"
+
+/*
+ * maximum size of a block of insize characters in stream, with
+ * header and code lengths. Codes are up to LENFILE_MAXBITS bits, so
+ * each character takes less than 2 bytes.
+ */
+#define STREAM_BLOCK_BOUND(insize) \
+  (BLOCKHEAD_SIZE + LENGTHS_MAXSIZE + 2*(insize) + 5*MAX_STREAMS + PACK_SLACK)
+
+/* maximum size of a dictionary made by huff_make_dict() */
+#define DICT_MAXSIZE (LENFILE_MAXSIZE + OPTIONS_MAXSIZE)
+
+/*
+ * huff_pointer
+ *
+ * State of encoding or decoding one stream. Blocks of the stream are
+ * coded one by one, and a block may use the code of the block before,
+ * so the code of the last block stays in code.
+ */
+typedef struct huff *huff_pointer;
+typedef struct huff {
+  options_struct opt;  // options of the stream
+  long long counts[256];  // frequencies of the block
+  code_struct own;     // code made from counts
+  code_struct code;    // code the block is coded by
+  int gen;             // number of code, increased for each new code, 0 if no code yet
+  int kind;            // kind of the block, 'C', 'R', 'S', 'F' or 'E'
+  int chars;           // characters in the block
+  int lensize;         // bytes of code lengths in the block
+  dectable_struct table;  // decoding table of code
+  int tablegen;        // gen of the code table is made for, 0 if not made
+  stats_pointer stats; // stats of coding set by huff_set_stats(), or NULL
+} huff_struct;
+
+/*
+ * huff_feed_pointer
+ *
+ * State of encoding or decoding one stream pushed in pieces, such as
+ * chunks of a socket as they arrive, by huff_feed(). Buffers of one
+ * block are made by huff_feed_new(), so no call allocates or blocks.
+ * Bits of a block of one stream are decoded as they arrive, and bits
+ * of a code not complete yet wait in bits for the next piece.
+ */
+typedef struct huff_feed *huff_feed_pointer;
+typedef struct huff_feed {
+  huff_pointer hp;     // options and code of the stream
+  int encode;          // 1 if encoding, 0 if decoding
+  int state;           // part of the stream to read next when decoding
+  int maxblock;        // characters in one block, the largest when decoding
+  unsigned char *buf;  // block to encode, or header or block gathered to decode
+  int have, need;      // bytes in buf, and bytes to gather before going on
+  unsigned char *out;  // bytes coded but not given yet
+  int outpos, outlen;  // next byte and end of them
+  int left;            // characters of the block not decoded yet
+  int bytesleft;       // bytes of the block not loaded to bits yet
+  unsigned long long bits;  // bit buffer, the next bit at the top
+  int count;           // bits in bits
+} huff_feed_struct;
+
+/* Functions hufflib.c offers */
+extern huff_pointer huff_new(int maxbits, int nstreams, int blocksize);
+extern void huff_free(huff_pointer hp);
+extern void huff_set_stats(huff_pointer hp, stats_pointer s);
+extern long long huff_bound(huff_pointer hp, long long len);
+extern long long huff_encode(huff_pointer hp, unsigned char *src, long long len, unsigned char *dst, long long cap);
+extern long long huff_decode(huff_pointer hp, unsigned char *src, long long len, unsigned char *dst, long long cap);
+extern long long huff_decoded_size(unsigned char *src, long long len);
+extern long long huff_decode_range(huff_pointer hp, unsigned char *src, long long len, long long offset,
+                                   unsigned char *dst, long long cap);
+
+/* Coding a stream pushed in pieces */
+extern huff_feed_pointer huff_feed_new(int encode, int maxbits, int nstreams, int blocksize);
+extern void huff_feed_free(huff_feed_pointer f);
+extern long long huff_feed(huff_feed_pointer f, unsigned char *in, long long len, long long *used,
+                           unsigned char *out, long long cap);
+extern long long huff_feed_end(huff_feed_pointer f, unsigned char *out, long long cap);
+
+/* Coding many small inputs by a dictionary, with no code in each */
+extern int huff_make_dict(long long *counts, long long size, int maxbits, unsigned char *out);
+extern huff_pointer huff_load_dict(unsigned char *dict, int len);
+extern long long huff_dict_encode(huff_pointer hp, unsigned char *src, long long len, unsigned char *dst, long long cap);
+extern long long huff_dict_size(unsigned char *src, long long len);
+extern long long huff_dict_decode(huff_pointer hp, unsigned char *src, long long len, unsigned char *dst, long long cap);
+
+/* Coding one block at a time, in steps that can run on threads */
+extern int huff_put_header(huff_pointer hp, unsigned char *out);
+extern int huff_get_header(huff_pointer hp, unsigned char *in, int len);
+extern void huff_count_block(huff_pointer hp, unsigned char *in, int insize);
+extern void huff_choose_code(huff_pointer hp, huff_pointer prev);
+extern int huff_write_block(huff_pointer hp, unsigned char *in, int insize, unsigned char *out);
+extern int huff_put_end(unsigned char *out);
+extern int huff_block_size(unsigned char *in);
+extern int huff_block_chars(unsigned char *in);
+extern int huff_read_block(huff_pointer hp, unsigned char *in, int len, huff_pointer prev);
+extern int huff_decode_block(huff_pointer hp, unsigned char *in, unsigned char *out);
@@ -0,0 +1,429 @@
+/*
+ * pool.c
+ *
+ * pool.c offers running jobs on a pool of threads.
+ *
+ * Jobs are numbered 0 to njobs-1. Each thread takes the next job
+ * number not taken yet and runs it, until no job is left. So threads
+ * which take fast jobs take more jobs, and all threads end at about
+ * the same time.
+ *
+ * pool.c offers pipelines too. A reader stage thread fills a ring of
+ * buffers while blocks are coded, and a writer stage thread empties
+ * another ring, so reading, coding and writing overlap.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "pool.h"
+
+/*
+ * pool_pointer
+ *
+ * Jobs shared by threads of the pool.
+ */
+typedef struct pool *pool_pointer;
+typedef struct pool {
+  pthread_mutex_t lock;  // lock for next
+  int next, njobs;       // next job to take, number of jobs
+  void (*job)(void *arg, int i);
+  void (*threadjob)(void *arg, int thread, int i);  // instead of job, by run_thread_jobs()
+  void *arg;
+} pool_struct;
+
+/*
+ * worker_pointer
+ *
+ * One thread of the pool.
+ */
+typedef struct worker *worker_pointer;
+typedef struct worker {
+  pool_pointer pool;
+  int thread;  // number of the thread, 0 for the calling thread
+} worker_struct;
+
+/*
+ * function worker
+ *
+ * Take jobs one by one and run them, until no job is left.
+ */
+static void *worker(void *p)
+{
+  pool_pointer pool = ((worker_pointer)p)->pool;
+  int i;
+  for (;;) {
+    pthread_mutex_lock(&pool->lock);
+    i = pool->next++;
+    pthread_mutex_unlock(&pool->lock);
+    if (i >= pool->njobs) break;
+    if (pool->threadjob != NULL) pool->threadjob(pool->arg, ((worker_pointer)p)->thread, i);
+    else pool->job(pool->arg, i);
+  }
+  return NULL;
+}
+
+/*
+ * function run_pool
+ *
+ * Run jobs of pool on nthreads threads, and return after all jobs are
+ * done.
+ */
+static void run_pool(pool_pointer pool, int nthreads)
+{
+  pthread_t threads[MAX_THREADS];
+  worker_struct workers[MAX_THREADS];
+  int i, started = 0;
+
+  pool->next = 0;
+  pthread_mutex_init(&pool->lock, NULL);
+  if (nthreads > pool->njobs) nthreads = (pool->njobs > 0 ? pool->njobs : 1);
+  for (i=0; i<nthreads; i++) {
+    workers[i].pool = pool;
+    workers[i].thread = i;
+  }
+  for (i=1; i<nthreads; i++) {
+    if (pthread_create(&threads[i], NULL, worker, &workers[i]) != 0) break;
+    started++;  // if thread can't be created, run with less threads
+  }
+  worker(&workers[0]);  // this thread is also a worker
+  for (i=1; i<=started; i++) pthread_join(threads[i], NULL);
+  pthread_mutex_destroy(&pool->lock);
+}
+
+/*
+ * function run_jobs
+ *
+ * Run job(arg, i) for each i from 0 to njobs-1 on nthreads threads,
+ * and return after all jobs are done. The calling thread is one of
+ * the threads, so nthreads 1 runs all jobs in order without threads.
+ *
+ * Arguments:
+ *      int nthreads - number of threads, 1 to MAX_THREADS.
+ *      int njobs - number of jobs.
+ *      void (*job)(void *arg, int i) - function to run job i.
+ *      void *arg - argument given to job.
+ */
+void run_jobs(int nthreads, int njobs, void (*job)(void *arg, int i), void *arg)
+{
+  pool_struct pool;
+  pool.njobs = njobs;
+  pool.job = job;
+  pool.threadjob = NULL;
+  pool.arg = arg;
+  run_pool(&pool, nthreads);
+}
+
+/*
+ * function run_thread_jobs
+ *
+ * Same as run_jobs(), but job(arg, thread, i) is also given the number
+ * of the thread running it, 0 to nthreads-1, so each thread can keep
+ * its own buffers for all jobs it runs.
+ */
+void run_thread_jobs(int nthreads, int njobs, void (*job)(void *arg, int thread, int i), void *arg)
+{
+  pool_struct pool;
+  pool.njobs = njobs;
+  pool.job = NULL;
+  pool.threadjob = job;
+  pool.arg = arg;
+  run_pool(&pool, nthreads);
+}
+
+/*
+ * ring_struct
+ *
+ * Buffers of a ring, used in order. Counters only grow, and buffer i
+ * of them is buf[i % nbufs]. The producer takes empty buffers and
+ * fills them, and the consumer takes full buffers and releases them,
+ * so taken - released <= nbufs.
+ */
+typedef struct ring {
+  pthread_mutex_t lock;  // lock for counters
+  pthread_cond_t cond;   // signaled when a counter changes
+  int nbufs, bufsize;    // number and bytes of buffers
+  unsigned char **buf;   // buffers
+  int *size;             // bytes filled in each buffer
+  long long taken, filled, used, released;  // counters of buffers
+  int closed;            // 1 if no more buffers will be filled
+  int stopped;           // 1 if the consumer needs no more buffers
+} ring_struct;
+
+/*
+ * function ring_new
+ *
+ * Make a ring of nbufs buffers of bufsize bytes.
+ *
+ * Returns:
+ *      New ring, or NULL if out of memory.
+ */
+ring_pointer ring_new(int nbufs, int bufsize)
+{
+  ring_pointer r = calloc(1, sizeof(ring_struct));
+  int i;
+  if (r == NULL) return NULL;
+  pthread_mutex_init(&r->lock, NULL);
+  pthread_cond_init(&r->cond, NULL);
+  r->nbufs = nbufs;
+  r->bufsize = bufsize;
+  r->buf = calloc(nbufs, sizeof(unsigned char *));
+  r->size = calloc(nbufs, sizeof(int));
+  if (r->buf == NULL || r->size == NULL) {
+    ring_free(r);
+    return NULL;
+  }
+  for (i=0; i<nbufs; i++) {
+    r->buf[i] = malloc(bufsize);
+    if (r->buf[i] == NULL) {
+      ring_free(r);
+      return NULL;
+    }
+  }
+  return r;
+}
+
+/*
+ * function ring_free
+ *
+ * Free ring made by ring_new(), when no thread uses it.
+ */
+void ring_free(ring_pointer r)
+{
+  int i;
+  if (r->buf != NULL)
+    for (i=0; i<r->nbufs; i++) free(r->buf[i]);
+  pthread_mutex_destroy(&r->lock);
+  pthread_cond_destroy(&r->cond);
+  free(r->buf);
+  free(r->size);
+  free(r);
+}
+
+/*
+ * function ring_empty
+ *
+ * Take the next empty buffer, waiting until the consumer releases one.
+ * The producer may take more buffers before filling them, up to nbufs.
+ *
+ * Returns:
+ *      Buffer of bufsize bytes, or NULL if ring_drain() stopped the
+ *      ring, and the producer should close it.
+ */
+unsigned char *ring_empty(ring_pointer r)
+{
+  unsigned char *p = NULL;
+  pthread_mutex_lock(&r->lock);
+  while (r->taken - r->released >= r->nbufs && !r->stopped) pthread_cond_wait(&r->cond, &r->lock);
+  if (!r->stopped) p = r->buf[r->taken++ % r->nbufs];
+  pthread_mutex_unlock(&r->lock);
+  return p;
+}
+
+/*
+ * function ring_fill
+ *
+ * Pass the first buffer taken by ring_empty() and not filled yet to the
+ * consumer, with size bytes in it. size may be negative, as an error
+ * the consumer finds.
+ */
+void ring_fill(ring_pointer r, int size)
+{
+  pthread_mutex_lock(&r->lock);
+  r->size[r->filled++ % r->nbufs] = size;
+  pthread_cond_broadcast(&r->cond);
+  pthread_mutex_unlock(&r->lock);
+}
+
+/*
+ * function ring_close
+ *
+ * Tell the consumer that no more buffers will be filled.
+ */
+void ring_close(ring_pointer r)
+{
+  pthread_mutex_lock(&r->lock);
+  r->closed = 1;
+  pthread_cond_broadcast(&r->cond);
+  pthread_mutex_unlock(&r->lock);
+}
+
+/*
+ * function ring_full
+ *
+ * Take the next full buffer, waiting until the producer fills one. The
+ * consumer may take more buffers before releasing them.
+ *
+ * Returns:
+ *      Buffer, with its bytes in size, or NULL if the ring is closed
+ *      and all buffers were taken.
+ */
+unsigned char *ring_full(ring_pointer r, int *size)
+{
+  unsigned char *p = NULL;
+  pthread_mutex_lock(&r->lock);
+  while (r->used == r->filled && !r->closed) pthread_cond_wait(&r->cond, &r->lock);
+  if (r->used < r->filled) {
+    *size = r->size[r->used % r->nbufs];
+    p = r->buf[r->used++ % r->nbufs];
+  }
+  pthread_mutex_unlock(&r->lock);
+  return p;
+}
+
+/*
+ * function ring_release
+ *
+ * Give the first buffer taken by ring_full() and not released yet back
+ * to the producer.
+ */
+void ring_release(ring_pointer r)
+{
+  pthread_mutex_lock(&r->lock);
+  r->released++;
+  pthread_cond_broadcast(&r->cond);
+  pthread_mutex_unlock(&r->lock);
+}
+
+/*
+ * function ring_drain
+ *
+ * Stop the producer, as the consumer needs no more buffers, and
+ * release full buffers until the producer closes the ring.
+ */
+void ring_drain(ring_pointer r)
+{
+  int size;
+  pthread_mutex_lock(&r->lock);
+  r->stopped = 1;
+  pthread_cond_broadcast(&r->cond);
+  pthread_mutex_unlock(&r->lock);
+  while (ring_full(r, &size) != NULL) ring_release(r);
+}
+
+/*
+ * stage_struct
+ *
+ * Thread of one stage, and the ring and file of reader and writer.
+ */
+typedef struct stage {
+  pthread_t thread;
+  void (*stage)(void *arg);
+  void *arg;
+  ring_pointer r;
+  FILE *f;
+} stage_struct;
+
+/*
+ * function run_stage
+ *
+ * Start routine of stage threads.
+ */
+static void *run_stage(void *p)
+{
+  stage_pointer s = p;
+  s->stage(s->arg);
+  return NULL;
+}
+
+/*
+ * function new_stage
+ *
+ * Run stage on its own thread, with s as its argument if arg is NULL.
+ * A pipeline can't run without its stages, so the program exits if the
+ * thread can't be created.
+ */
+static stage_pointer new_stage(void (*stage)(void *arg), void *arg, ring_pointer r, FILE *f)
+{
+  stage_pointer s = calloc(1, sizeof(stage_struct));
+  if (s == NULL) {
+    fprintf(stderr, "Out of memory!\n");
+    exit(1);
+  }
+  s->stage = stage;
+  s->arg = (arg != NULL ? arg : s);
+  s->r = r;
+  s->f = f;
+  if (pthread_create(&s->thread, NULL, run_stage, s) != 0) {
+    fprintf(stderr, "Can't start thread\n");
+    exit(1);
+  }
+  return s;
+}
+
+/*
+ * function start_stage
+ *
+ * Run stage(arg) on its own thread until join_stage().
+ */
+stage_pointer start_stage(void (*stage)(void *arg), void *arg)
+{
+  return new_stage(stage, arg, NULL, NULL);
+}
+
+/*
+ * function reader
+ *
+ * Stage of start_reader(): read f to buffers until the end of file.
+ */
+static void reader(void *arg)
+{
+  stage_pointer s = arg;
+  unsigned char *p;
+  int n;
+  while ((p = ring_empty(s->r)) != NULL) {
+    n = fread(p, 1, s->r->bufsize, s->f);
+    ring_fill(s->r, n);
+    if (n == 0) break;
+  }
+  ring_close(s->r);
+}
+
+/*
+ * function writer
+ *
+ * Stage of start_writer(): write buffers to f until the ring closes.
+ */
+static void writer(void *arg)
+{
+  stage_pointer s = arg;
+  unsigned char *p;
+  int n;
+  while ((p = ring_full(s->r, &n)) != NULL) {
+    if (n > 0) fwrite(p, 1, n, s->f);
+    ring_release(s->r);
+  }
+}
+
+/*
+ * function start_reader
+ *
+ * Start a reader stage, which reads f by bufsize bytes to buffers of r
+ * and closes r at the end of file, or when ring_drain() stops it. The
+ * last full buffer at the end of file has 0 bytes.
+ */
+stage_pointer start_reader(ring_pointer r, FILE *f)
+{
+  return new_stage(reader, NULL, r, f);
+}
+
+/*
+ * function start_writer
+ *
+ * Start a writer stage, which writes full buffers of r to f in order,
+ * until r is closed and empty.
+ */
+stage_pointer start_writer(ring_pointer r, FILE *f)
+{
+  return new_stage(writer, NULL, r, f);
+}
+
+/*
+ * function join_stage
+ *
+ * Wait until the stage ends, and free it.
+ */
+void join_stage(stage_pointer s)
+{
+  pthread_join(s->thread, NULL);
+  free(s);
+}
@@ -0,0 +1,40 @@
+/*
+ * pool.h
+ *
+ * Header file for pool.c
+ */
+
+#define MAX_THREADS 64  // Maximum number of threads.
+#define MAX_BUFFERS 64  // Maximum number of buffers of a ring more than threads.
+#define DEF_IOSIZE (64 << 10)  // Default bytes of a buffer of a ring.
+
+/*
+ * ring_pointer
+ *
+ * Ring of buffers passed from a producer to a consumer thread in
+ * order, made by ring_new().
+ */
+typedef struct ring *ring_pointer;
+
+/*
+ * stage_pointer
+ *
+ * Thread running one stage of a pipeline, made by start_stage().
+ */
+typedef struct stage *stage_pointer;
+
+/* Functions pool.c offers */
+extern void run_jobs(int nthreads, int njobs, void (*job)(void *arg, int i), void *arg);
+extern void run_thread_jobs(int nthreads, int njobs, void (*job)(void *arg, int thread, int i), void *arg);
+extern ring_pointer ring_new(int nbufs, int bufsize);
+extern void ring_free(ring_pointer r);
+extern unsigned char *ring_empty(ring_pointer r);
+extern void ring_fill(ring_pointer r, int size);
+extern void ring_close(ring_pointer r);
+extern unsigned char *ring_full(ring_pointer r, int *size);
+extern void ring_release(ring_pointer r);
+extern void ring_drain(ring_pointer r);
+extern stage_pointer start_stage(void (*stage)(void *arg), void *arg);
+extern stage_pointer start_reader(ring_pointer r, FILE *f);
+extern stage_pointer start_writer(ring_pointer r, FILE *f);
+extern void join_stage(stage_pointer s);
@@ -0,0 +1,157 @@
+/*
+ * stats.c
+ *
+ * stats.c offers timing of phases of coding and counters of what was
+ * coded, printed as one line of JSON by stats_print().
+ *
+ * Time is taken only when the phase changes, not for each block or
+ * character, so timing costs nothing measurable. CPU time is of the
+ * whole process, with the time of worker threads, unless threadclock
+ * is set, for a library user coding on threads.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "huff.h"
+#include "stats.h"
+
+/*
+ * Names of phases in the output. PHASE_CODING is "encode" or "decode".
+ */
+static char *phasename[NPHASES] = { "histogram", "tree", "code", "encode", "io" };
+
+/*
+ * function seconds
+ *
+ * Returns:
+ *      Seconds of clock.
+ */
+static double seconds(clockid_t clock)
+{
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/*
+ * function stats_init
+ *
+ * Clear s, with no phase timed yet.
+ */
+void stats_init(stats_pointer s, int decode)
+{
+  memset(s, 0, sizeof(stats_struct));
+  s->phase = PHASE_NONE;
+  s->decode = decode;
+}
+
+/*
+ * function stats_phase
+ *
+ * Charge the time since the current phase started to it, and start
+ * phase, or stop timing with PHASE_NONE. Does nothing if s is NULL,
+ * so callers need not check if stats are wanted.
+ */
+void stats_phase(stats_pointer s, int phase)
+{
+  double wall, cpu;
+  if (s == NULL || s->phase == phase) return;
+  wall = seconds(CLOCK_MONOTONIC);
+  cpu = seconds(s->threadclock ? CLOCK_THREAD_CPUTIME_ID : CLOCK_PROCESS_CPUTIME_ID);
+  if (s->phase != PHASE_NONE) {
+    s->wall[s->phase] += wall - s->startwall;
+    s->cpu[s->phase] += cpu - s->startcpu;
+  }
+  s->phase = phase;
+  s->startwall = wall;
+  s->startcpu = cpu;
+}
+
+/*
+ * function stats_code
+ *
+ * Add characters of counts coded by code c to s.
+ */
+void stats_code(stats_pointer s, long long *counts, code_pointer c)
+{
+  int i;
+  if (s == NULL) return;
+  for (i=0; i<256; i++) {
+    if (counts[i] == 0) continue;
+    s->counts[i] += counts[i];
+    if (c->bitlength[i] > s->maxlen) s->maxlen = c->bitlength[i];
+  }
+  s->codebits += code_bits(counts, c);
+}
+
+/*
+ * function stats_count
+ *
+ * Count size characters of in, which were coded by code c, and add
+ * them to s. For decoding, where frequencies are not known.
+ */
+void stats_count(stats_pointer s, unsigned char *in, long long size, code_pointer c)
+{
+  long long counts[256], done;
+  int n;
+  if (s == NULL) return;
+  memset(counts, 0, sizeof(counts));
+  for (done=0; done<size; done+=n) {  // by COUNT_CHUNK, as count_bytes() takes int
+    n = (size - done < COUNT_CHUNK ? size - done : COUNT_CHUNK);
+    count_bytes(in + done, n, counts);
+  }
+  stats_code(s, counts, c);
+}
+
+/*
+ * function stats_stored
+ *
+ * Count size characters of in, which were stored or filled in a block
+ * of bits bits instead of coded, and add them to s.
+ */
+void stats_stored(stats_pointer s, unsigned char *in, long long size, long long bits)
+{
+  long long counts[256];
+  int i;
+  if (s == NULL) return;
+  memset(counts, 0, sizeof(counts));
+  count_bytes(in, size, counts);  // blocks are up to MAX_BLOCKSIZE
+  for (i=0; i<256; i++) s->counts[i] += counts[i];
+  s->codebits += bits;
+}
+
+/*
+ * function stats_print
+ *
+ * Stop timing and print s to f as one line of JSON: bytes read and
+ * written, their ratio, the longest code length, average bits of codes
+ * and entropy of the characters in bits per character, and wall clock
+ * and CPU seconds of each phase and of all phases.
+ */
+void stats_print(stats_pointer s, FILE *f, char *tool)
+{
+  double wall = 0, cpu = 0, p, entropy = 0;
+  long long total = 0;
+  int i;
+
+  stats_phase(s, PHASE_NONE);
+  for (i=0; i<256; i++) total += s->counts[i];
+  for (i=0; i<256; i++) {
+    if (s->counts[i] == 0) continue;
+    p = (double)s->counts[i] / total;
+    entropy -= p * log2(p);
+  }
+  fprintf(f, "{\"tool\": \"%s\", \"bytes_in\": %lld, \"bytes_out\": %lld, \"ratio\": %.6f, "
+          "\"max_code_length\": %d, \"bits_per_symbol\": %.6f, \"entropy\": %.6f, \"phases\": {",
+          tool, s->bytesin, s->bytesout, (s->bytesin != 0 ? (double)s->bytesout / s->bytesin : 0),
+          s->maxlen, (total != 0 ? (double)s->codebits / total : 0), entropy);
+  for (i=0; i<NPHASES; i++) {
+    fprintf(f, "%s\"%s\": {\"wall\": %.6f, \"cpu\": %.6f}", (i == 0 ? "" : ", "),
+            (i == PHASE_CODING && s->decode ? "decode" : phasename[i]), s->wall[i], s->cpu[i]);
+    wall += s->wall[i];
+    cpu += s->cpu[i];
+  }
+  fprintf(f, "}, \"total\": {\"wall\": %.6f, \"cpu\": %.6f}}\n", wall, cpu);
+  fflush(f);
+}
@@ -0,0 +1,47 @@
+/*
+ * stats.h
+ *
+ * Header file for stats.c
+ *
+ * stats.c measures wall and CPU time of each phase of coding and
+ * counts what was coded, for --stats of huffenc and huffdec and for
+ * huff_set_stats() of hufflib.c. Include huff.h before this file.
+ */
+
+/* Phases of coding timed by stats_phase() */
+#define PHASE_NONE -1     // not timed
+#define PHASE_HISTOGRAM 0 // counting frequencies
+#define PHASE_TREE 1      // making huffman tree
+#define PHASE_CODE 2      // making huffman code and decoding table
+#define PHASE_CODING 3    // encoding or decoding
+#define PHASE_IO 4        // reading and writing files
+#define NPHASES 5
+
+/*
+ * stats_pointer
+ *
+ * Time of each phase and counters of coding. Time is charged to the
+ * current phase until stats_phase() changes it, so phases don't
+ * overlap and their sum is the time coding took.
+ */
+typedef struct stats *stats_pointer;
+typedef struct stats {
+  double wall[NPHASES];  // wall clock seconds of each phase
+  double cpu[NPHASES];   // CPU seconds of each phase
+  int phase;             // current phase, PHASE_NONE if not timed
+  double startwall, startcpu;  // time the current phase started
+  int threadclock;       // 1 if CPU time of the calling thread only
+  int decode;            // 1 if decoding
+  long long bytesin, bytesout;  // bytes read and written
+  long long counts[256]; // frequencies of the characters coded
+  long long codebits;    // bits of their codes
+  int maxlen;            // longest code length used
+} stats_struct;
+
+/* Functions stats.c offers */
+extern void stats_init(stats_pointer s, int decode);
+extern void stats_phase(stats_pointer s, int phase);
+extern void stats_code(stats_pointer s, long long *counts, code_pointer c);
+extern void stats_count(stats_pointer s, unsigned char *in, long long size, code_pointer c);
+extern void stats_stored(stats_pointer s, unsigned char *in, long long size, long long bits);
+extern void stats_print(stats_pointer s, FILE *f, char *tool);